@@ -1,3 +1,5 @@
+# テーブルを共有メモリに置いて再起動時に使い回す
+export MAHJONG_TABLE_SHM=/akinasu_tables
 for i in {0..1000};
 do
   ./out/release/fg_client
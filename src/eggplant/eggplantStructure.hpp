@@ -17,6 +17,7 @@
 
 #include "value.hpp"
 #include "turnActionPolicy.hpp"
+#include "lookahead.hpp"
 
 namespace Mahjong{
     namespace Eggplant{
@@ -173,7 +174,7 @@ namespace Mahjong{
             }
             
             template<class field_t>
-            void init(const action_t&, field_t&, Player);
+            void init(const action_t&, field_t&, Player, const LookaheadInfo&);
             
             template<class result_t>
             void feed(const result_t& result)noexcept{
@@ -202,7 +203,8 @@ namespace Mahjong{
         };
         
         template<>template<class field_t>
-        void RootActionInfo<TurnAction>::init(const TurnAction& aa, field_t& field, Player pn){
+        void RootActionInfo<TurnAction>::init(const TurnAction& aa, field_t& field, Player pn,
+                                              const LookaheadInfo& li){
             action = aa;
             
             initSatistics();
@@ -212,17 +214,29 @@ namespace Mahjong{
             
             // 基本的な性質をセット
             if(!field.isInReach(field.turnPlayer)){
-                if(!aa.finish()){
+                if(aa.discard()){ // 打牌は計算済み
+                    const Piece p = toPiece(aa.discarded());
+                    minimumSteps = li.discard.steps[p];
+                    acceptable = li.discard.acceptable[p];
+                }else if(!aa.finish()){
                     DiffHandInfo diff;
                     NextHandInfo next;
                     doTurnAction(&hand, aa, &diff, &next);
                     ASSERT(hand.exam(), cerr << hand.toDebugString() << endl;);
-                    minimumSteps = calcMinimumSteps(hand, &acceptable);
+                    minimumSteps = next.minimumSteps;
+                    acceptable = next.acceptable;
                     undoTurnAction(&hand, aa, diff);
                     ASSERT(hand.exam(), cerr << hand.toDebugString() << endl;);
-                    acceptableNum = acceptable.count();
+                }else{ // あがり
+                    minimumSteps = -1;
+                    acceptable.reset();
+                }
+                // 受け入れは見えていない残り枚数で数える
+                acceptableNum = countPieces(field.uncertain[pn], acceptable);
+                policyScore = -minimumSteps + acceptableNum / double(N_ALL_PIECES);
+                if(aa.discard() && li.evaluated.test(toPiece(aa.discarded()))){ // 次の自摸の後の受け入れ
+                    policyScore += 0.5 * li.expectedAcceptable[toPiece(aa.discarded())] / double(N_ALL_PIECES);
                 }
-                policyScore = -minimumSteps + acceptableNum / double(N_PIECES);
             }else{
                 minimumSteps = 0;
             }
@@ -233,7 +247,8 @@ namespace Mahjong{
         }
 
         template<>template<class field_t>
-        void RootActionInfo<ResponseAction>::init(const ResponseAction& aa, field_t& field, Player pn){
+        void RootActionInfo<ResponseAction>::init(const ResponseAction& aa, field_t& field, Player pn,
+                                                  const LookaheadInfo& li){
             action = aa;
             initSatistics();
             policyScore = 0;
@@ -268,8 +283,13 @@ namespace Mahjong{
             void setActions(action_t *const pact, const int aactions, field_t& field, Player pn){
                 originalScore = field.score[pn];
                 actions = aactions;
+                // ツモ手番なら打牌候補のシャンテン数と次の自摸の後の受け入れをまとめて計算しておく
+                LookaheadInfo li;
+                if(std::is_same<action_t, TurnAction>::value && !field.isInReach(pn)){
+                    evalDiscardLookahead(field.hand[pn], field.uncertain[pn], &li);
+                }
                 for(int i = 0; i < actions; ++i){
-                    action[i].init(pact[i], field, pn);
+                    action[i].init(pact[i], field, pn, li);
                     allUtility += action[i].utility;
                 }
             }
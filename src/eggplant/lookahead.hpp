@@ -0,0 +1,208 @@
+/*
+ lookahead.hpp
+ Katsuki Ohto
+ */
+
+// 打牌候補の2手先までの受け入れ評価
+
+#ifndef MAHJONG_EGGPLANT_LOOKAHEAD_HPP_
+#define MAHJONG_EGGPLANT_LOOKAHEAD_HPP_
+
+#include "../mahjong.hpp"
+
+namespace Mahjong{
+    namespace Eggplant{
+
+        // 各打牌候補について
+        // 1. 打牌後の受け入れ残り枚数
+        // 2. 受け入れ牌を1枚引いた後、シャンテン数を保つ最善の打牌をしたときの受け入れ残り枚数の期待値
+        // を求める
+        // 2手先の13枚の形は打牌と自摸の順番が入れ替わっただけで同じになることが多いので、
+        // 形ごとの結果を記録して同じ形は計算しない
+        // 2手目の残り枚数は1枚目に引いた牌を見えない牌から除かずに数える(近似)
+
+        struct LookaheadHand{
+            // 先読み用の軽い手牌
+            uint32_t index[N_NUMBER_PIECE_TYPES]; // pieceMin と同じ5進数の添字
+            uint64_t pqr[N_PIECE_TYPES], sc[N_PIECE_TYPES];
+            int opened;
+
+            template<class hand_t>
+            void set(const hand_t& hand){
+                for(PieceType pt = PIECE_TYPE_NUMBERS_MIN; pt <= PIECE_TYPE_NUMBERS_MAX; ++pt){
+                    index[pt] = hand.pieceMin[pt].data();
+                }
+                for(PieceType pt = PIECE_TYPE_MIN; pt <= PIECE_TYPE_MAX; ++pt){
+                    pqr[pt] = hand.pqr[pt];
+                    sc[pt] = hand.sc[pt];
+                }
+                opened = hand.openedMelds();
+            }
+            int openedMelds()const noexcept{ return opened; }
+
+            void add(Piece p)noexcept{
+                const PieceType pt = toPieceType(p);
+                const Rank r = toRank(p);
+                const uint64_t rankMask = rankMask4(r);
+                if(pt != HONOR){ index[pt] += ipow5Table[r]; }
+                pqr[pt] = ((pqr[pt] & rankMask) << 1) | (~sc[pt] & rankMask & PQR_1) | (pqr[pt] & ~rankMask);
+                sc[pt] |= ((sc[pt] & rankMask) << 1) | (rankMask & PQR_1);
+            }
+            void sub(Piece p)noexcept{
+                const PieceType pt = toPieceType(p);
+                const Rank r = toRank(p);
+                const uint64_t rankMask = rankMask4(r);
+                if(pt != HONOR){ index[pt] -= ipow5Table[r]; }
+                const uint64_t opqr = pqr[pt];
+                pqr[pt] = (opqr & ~rankMask) | (((opqr & rankMask) >> 1) & rankMask);
+                sc[pt] -= opqr & rankMask;
+            }
+            uint64_t existance()const noexcept{
+                uint64_t ex = 0;
+                for(PieceType pt = PIECE_TYPE_MIN; pt <= PIECE_TYPE_MAX; ++pt){
+                    ex |= pext(sc[pt], PQR_1) << toPiece(pt, RANK_MIN);
+                }
+                return ex;
+            }
+            // 形を一意に表すキー (数牌の添字 21ビット x 3, 字牌の sc 28ビット)
+            uint64_t numberKey()const noexcept{
+                return uint64_t(index[0]) | (uint64_t(index[1]) << 21) | (uint64_t(index[2]) << 42);
+            }
+            uint32_t honorKey()const noexcept{
+                return uint32_t(sc[HONOR]);
+            }
+        };
+
+        struct LookaheadMemo{
+            // 13枚の形ごとのシャンテン数と受け入れ残り枚数
+            // 呼び出しごとに世代を進めるので消去は不要
+            // 埋まりすぎたら記録せずに計算だけする
+            static constexpr int SIZE_LOG2 = 12;
+            static constexpr int SIZE = 1 << SIZE_LOG2;
+            static constexpr int MAX_ENTRIES = SIZE * 3 / 4;
+            struct Entry{
+                uint64_t numberKey;
+                uint32_t honorKey;
+                uint32_t generation;
+                int steps, acceptableNum;
+            };
+            std::array<Entry, SIZE> entry;
+            Entry overflow;
+            uint32_t generation;
+            int entries;
+            int hits, misses;
+
+            LookaheadMemo(){
+                for(Entry& e : entry){ e.generation = 0; }
+                generation = 0;
+                entries = 0;
+                hits = misses = 0;
+            }
+            void next()noexcept{
+                entries = 0;
+                generation += 1;
+                if(generation == 0){ // 一周したら消す
+                    for(Entry& e : entry){ e.generation = 0; }
+                    generation = 1;
+                }
+            }
+            template<class callback_t>
+            const Entry& get(const LookaheadHand& hand, const callback_t& calc){
+                const uint64_t nk = hand.numberKey();
+                const uint32_t hk = hand.honorKey();
+                uint32_t i = uint32_t(((nk ^ (uint64_t(hk) << 40)) * 0x9e3779b97f4a7c15ULL) >> (64 - SIZE_LOG2));
+                while(true){
+                    Entry& e = entry[i];
+                    if(e.generation != generation){ // 空き
+                        misses += 1;
+                        if(entries >= MAX_ENTRIES){
+                            calc(hand, &overflow.steps, &overflow.acceptableNum);
+                            return overflow;
+                        }
+                        entries += 1;
+                        e.numberKey = nk;
+                        e.honorKey = hk;
+                        e.generation = generation;
+                        calc(hand, &e.steps, &e.acceptableNum);
+                        return e;
+                    }
+                    if(e.numberKey == nk && e.honorKey == hk){
+                        hits += 1;
+                        return e;
+                    }
+                    i = (i + 1) & (SIZE - 1);
+                }
+            }
+        };
+
+        // シミュレーション中にも使えるようにスレッドごとに持つ
+        thread_local LookaheadMemo lookaheadMemo;
+
+        struct LookaheadInfo{
+            DiscardStepsInfo discard; // 1手目(打牌後)のシャンテン数と受け入れ牌
+            PieceExistance evaluated; // 2手先まで評価した打牌(シャンテン数最小のもの)
+            int acceptableNum[PIECE_MAX + 1]; // 打牌後の受け入れ残り枚数
+            double expectedAcceptable[PIECE_MAX + 1]; // 受け入れ1枚を引いた後の最善打牌での受け入れ残り枚数の期待値
+        };
+
+        template<class hand_t>
+        int evalDiscardLookahead(const hand_t& hand, const PieceSet& unseen,
+                                 LookaheadInfo *const pinfo, LookaheadMemo *const pmemo = &lookaheadMemo){
+            // 返り値は打牌後の最小シャンテン数
+            // 期待値は打牌後のシャンテン数が最小の候補についてだけ求める
+            // 聴牌ならば次の自摸で形は良くならないので期待値は0のまま
+            const int minSteps = calcDiscardMinimumSteps(hand, &pinfo->discard);
+            pmemo->next();
+
+            auto calc = [&unseen](const LookaheadHand& h, int *const psteps, int *const pnum)->void{
+                const StepsInfoRecord *records[N_NUMBER_PIECE_TYPES];
+                for(PieceType pt = PIECE_TYPE_NUMBERS_MIN; pt <= PIECE_TYPE_NUMBERS_MAX; ++pt){
+                    records[pt] = stepsInfoTable + h.index[pt];
+                }
+                PieceExistance acceptable;
+                *psteps = calcMinimumSteps(h, records, &acceptable);
+                *pnum = countPieces(unseen, acceptable);
+            };
+
+            LookaheadHand base;
+            base.set(hand);
+            pinfo->evaluated.reset();
+            for(uint64_t cand = pinfo->discard.candidates; cand; cand &= cand - 1){
+                const Piece d = static_cast<Piece>(bsf(cand));
+                const PieceExistance acceptable = pinfo->discard.acceptable[d];
+                pinfo->acceptableNum[d] = countPieces(unseen, acceptable);
+                pinfo->expectedAcceptable[d] = 0;
+                const int steps = pinfo->discard.steps[d];
+                if(steps != minSteps || steps < 0){ continue; }
+                pinfo->evaluated.set(d);
+
+                LookaheadHand h13 = base;
+                h13.sub(d);
+                double expected = 0;
+                for(uint64_t acc = acceptable; acc; acc &= acc - 1){
+                    const Piece t = static_cast<Piece>(bsf(acc));
+                    const int w = unseen.contains(t);
+                    if(w == 0){ continue; }
+                    LookaheadHand h14 = h13;
+                    h14.add(t);
+                    int best = 0;
+                    // 引いた牌をそのまま捨てると元の形に戻るので除く
+                    for(uint64_t next = h14.existance() & ~(1ULL << t); next; next &= next - 1){
+                        const Piece d2 = static_cast<Piece>(bsf(next));
+                        LookaheadHand h = h14;
+                        h.sub(d2);
+                        const LookaheadMemo::Entry& e = pmemo->get(h, calc);
+                        if(e.steps < steps){ best = max(best, e.acceptableNum); }
+                    }
+                    expected += w * best;
+                }
+                if(pinfo->acceptableNum[d] > 0){
+                    pinfo->expectedAcceptable[d] = expected / pinfo->acceptableNum[d];
+                }
+            }
+            return minSteps;
+        }
+    }
+}
+
+#endif // MAHJONG_EGGPLANT_LOOKAHEAD_HPP_
@@ -69,13 +69,15 @@ namespace Mahjong{
             pfield->setTurn(turnPlayer, drawn);
             if(pfield->isInReach(turnPlayer)){ // リーチ時
                 // あがれるなら上がる
-                if(pfield->hand[turnPlayer].isAcceptable(toPiece(drawn))){
+                if(pfield->hand[turnPlayer].isAcceptable(toPiece(drawn))
+                   && isValidWin(*pfield, turnPlayer, true)){
                     DERR << "draw-win" << endl;
                     wonPlayers.set(turnPlayer);
                     presult->drawWin = true;
                     
                     std::array<BonusStatus, N_PLAYERS> bonus;
-                    calcScoreWin(pfield, wonPlayers, presult->drawWin, &bonus);
+                    const int ret = calcScoreWin(pfield, wonPlayers, presult->drawWin, &bonus);
+                    ASSERT(ret >= 0, cerr << pfield->toDebugString(););
                     goto END_GAME;
                 }
                 pfti->turnAction.clear().setDiscarded(drawn).setParrot();
@@ -174,7 +176,9 @@ namespace Mahjong{
                     const ResponseAction& ra = pfti->responseAction[pn];
                     DERR << "response " << pn << " : " << ra << endl;
                     if(pfti->responseAction[pn].finish()){ // 上がりのあるプレーヤーがいるか調べる
-                        wonPlayers.set(pn);
+                        if(isValidWin(*pfield, pn, false)){ // 役の無いロンは無かったことにする
+                            wonPlayers.set(pn);
+                        }
                     }else if(isPreferred(ra, realizedResponseAction)){ // 優先度高い
                         responsePlayer = pn;
                         realizedResponseAction = ra;
@@ -208,7 +212,8 @@ namespace Mahjong{
                     calcScoreIrregularDraw(pfield); // 連荘の場合の引き分け処理
                 }else{ // 上がりが有効
                     std::array<BonusStatus, N_PLAYERS> bonus;
-                    calcScoreWin(pfield, wonPlayers, presult->drawWin, &bonus);
+                    const int ret = calcScoreWin(pfield, wonPlayers, presult->drawWin, &bonus);
+                    ASSERT(ret >= 0, cerr << pfield->toDebugString(););
                 }
                 goto END_GAME;
             }
@@ -258,13 +263,18 @@ namespace Mahjong{
                 field_t field = *pfield;
                 dealPiecesAllRandom(&field.wall, &field.hand, &field.uncertain, field, &ptools->dice);
                 field.myPlayerNum = NONE_PLAYER; // 客観s
+                field.hashKey = field.calcHashKey(); // 手牌を直接設定したので計算し直す
                 //cerr << field.wall << endl;
+                // シミュレーションでは候補行動ごとに盤面をコピーするので手牌を軽い形にしておく
+                // (プレイアウトは局の終わりまで進んで殆どの情報を書き換えるので、巻き戻しよりコピーの方が速い)
+                SimField sfield;
+                sfield.setFrom(field);
                 // 全ての候補行動に対して同じ世界でシミュレーション
                 for(int i = 0; i < proot->actions; ++i){
                     const auto& a = proot->action[i].action;
                     if(!a.finish()){
                         DERR << "world " << worldIndex << " action " << a << endl;
-                        field_t tfield = field;
+                        SimField tfield = sfield;
                         //doAction(&tfield, proot->action[i]);
                         FieldTemporalInfo fti;
                         // 初手の設定
@@ -276,6 +286,8 @@ namespace Mahjong{
                 }
                 worldIndex += 1;
             }
+            DERR << "thread " << threadIndex << " : " << worldIndex << " worlds ("
+            << worldIndex * 1000.0 / clms.stop() << " worlds/s)" << endl;
             return 0;
         }
         
@@ -285,6 +297,7 @@ namespace Mahjong{
                                sharedData_t *const pshared,
                                threadTools_t tools[]){
             
+            stepsCache.clearStats();
             if(Settings::NThreads > 1){
                 // open threads
                 std::vector<std::thread> thr;
@@ -299,6 +312,8 @@ namespace Mahjong{
                 // call function
                 monteCarloThread<root_t, field_t, sharedData_t, threadTools_t>(0, proot, &field, pshared, &tools[0]);
             }
+            DERR << "steps cache : " << stepsCache.hits() << " / " << stepsCache.probes()
+            << " (" << stepsCache.hitRate() << ")" << endl;
             return 0;
         }
     }
@@ -71,7 +71,7 @@ namespace Mahjong{
             mdl.template initCalculatingScore<M>(actions);
             
             Player turnPlayer = field.turnPlayer;
-            Hand& hand = field.hand[turnPlayer];
+            auto& hand = field.hand[turnPlayer];
             
             /*auto finishPolicyFunc = [&](action_t *const pact)->double{
              // あがる場合の方策計算
@@ -111,21 +111,34 @@ namespace Mahjong{
             
             NextHandInfo nhi[N_MAX_TURN_ACTIONS];
             
+            // 打牌は捨てる牌の種類ごとにまとめて計算しておく
+            DiscardStepsInfo dsi;
+            calcDiscardMinimumSteps(stepsView(hand), &dsi);
+            
             for(int i = 0; i < actions; ++i){
                 double s = 0;
                 const action_t a = action[i];
-                DiffHandInfo dhi;
-                
-                doTurnAction(&hand, a, &dhi, &nhi[i]);
-                
-                PieceExistance acceptable;
-                int steps = calcMinimumSteps(hand, &acceptable);
+                NextHandInfo& next = nhi[i];
+                int reds;
                 
-                s -= steps;
-                s += acceptable.count() / N_PIECES;
-                s += 0.15 * hand.countAllReds();
+                if(a.discard()){
+                    const Piece p = toPiece(a.discarded());
+                    next.minimumSteps = dsi.steps[p];
+                    next.acceptable = dsi.acceptable[p];
+                    reds = hand.countAllReds() - (isRed(a.discarded()) ? 1 : 0);
+                }else{ // 打牌以外
+                    DiffHandInfo dhi;
+                    
+                    doTurnAction(&hand, a, &dhi, &next);
+                    reds = hand.countAllReds();
+                    undoTurnAction(&hand, a, dhi);
+                }
+                // 受け入れは見えていない残り枚数で数える
+                next.acceptableNum = countPieces(field.uncertain[turnPlayer], next.acceptable);
                 
-                undoTurnAction(&hand, a, dhi);
+                s -= next.minimumSteps;
+                s += next.acceptableNum / double(N_ALL_PIECES);
+                s += 0.15 * reds;
                 
                 score[i] = s;
                 
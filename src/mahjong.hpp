@@ -22,19 +22,31 @@ namespace Mahjong{
     /**************************初期化**************************/
     
     struct MahjongInitializer{
+        // テーブルの準備は別スレッドで行い、main 以降の通信等と重ねる
+        // テーブルを使う側は waitStepsTables() で待つ(calcMinimumSteps 内で自動的に待つ)
+        std::thread tableThread;
+        
         MahjongInitializer(){
             // ハッシュ値計算用のテーブル初期化
             initHash();
+            initFieldHash();
             
             // シャンテン数、受け入れ数計算用テーブル読み込み
-            tick();
-            initShantenTable();
-            initAcceptableTable();
-            tock();
-            tick();
-            initMinimumStepsInfoTable();
-            initAcceptableInfoTable();
-            tock();
+            // 水上さんのテーブル(initShantenTable, initAcceptableTable)は検証、変換用なので必要な所で読む
+            tableThread = std::thread([]()->void{
+                tick();
+                if(initStepsTables() < 0){
+                    cerr << "failed to prepare steps tables." << endl;
+                }
+                if(initSuitDecompositionTables() < 0){
+                    cerr << "failed to prepare decomposition tables." << endl;
+                }
+                tock();
+                setStepsTablesReady();
+            });
+        }
+        ~MahjongInitializer(){
+            if(tableThread.joinable()){ tableThread.join(); }
         }
     };
     
@@ -203,7 +203,7 @@ namespace Mahjong{
         PieceExistance acceptable;
         
         if(field.isInReach(turnPlayer)){
-            if(hand.isAcceptable(toPiece(drawn))){
+            if(hand.isAcceptable(toPiece(drawn)) && isValidWin(field, turnPlayer, true)){
                 pac->setFinish(); ++pac;
             }else{
                 pac->clear().setDiscarded(drawn); ++pac;
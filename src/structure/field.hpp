@@ -14,11 +14,50 @@
 
 namespace Mahjong{
     
+    /**************************盤面のハッシュ値**************************/
+    
+    // 盤面全体のハッシュ値は以下の項の和で、手牌のハッシュキーと同じく加算で差分更新する
+    // (同じ面子を2回鳴いたときなどに xor では打ち消し合ってしまう)
+    // - 手牌 : 手牌のハッシュキー * プレーヤーごとの乱数
+    // - 鳴き : 晒した牌のハッシュ値 * プレーヤーごとの乱数 + 面子の形(順子か刻子か)の項
+    // - 捨て牌 : 牌のハッシュ値 * (プレーヤー, 何枚目) ごとの乱数
+    // - ドラ表示牌、リーチ、手番プレーヤー、手数
+    // 掛ける乱数は奇数にしておく
+    
+    struct FieldHashTable{
+        std::array<uint64_t, N_PLAYERS> concealed, opened, openedSeq, openedGroup;
+        std::array<uint64_t, N_PLAYERS> reach, turnPlayer;
+        std::array<std::array<uint64_t, N_DISCARD_PIECES>, N_PLAYERS> discarded;
+        uint64_t dora, turn;
+    };
+    
+    FieldHashTable fieldHashTable;
+    
+    int initFieldHash()noexcept{
+        XorShift64 dice(1115);
+        for(Player pn = 0; pn < N_PLAYERS; ++pn){
+            fieldHashTable.concealed[pn] = dice.rand() | 1ULL;
+            fieldHashTable.opened[pn] = dice.rand() | 1ULL;
+            fieldHashTable.openedSeq[pn] = dice.rand() | 1ULL;
+            fieldHashTable.openedGroup[pn] = dice.rand() | 1ULL;
+            fieldHashTable.reach[pn] = dice.rand();
+            fieldHashTable.turnPlayer[pn] = dice.rand();
+            for(int i = 0; i < N_DISCARD_PIECES; ++i){
+                fieldHashTable.discarded[pn][i] = dice.rand() | 1ULL;
+            }
+        }
+        fieldHashTable.dora = dice.rand() | 1ULL;
+        fieldHashTable.turn = dice.rand() | 1ULL;
+        return 0;
+    }
+    
     /**************************盤面情報**************************/
     
-    struct Field{
+    template<class hand_t>
+    struct FieldBase{
         // 盤面データ
         // 主観的情報のみ用いる場合はそれ以外の箇所の値は未定義
+        // 手牌の型は通常 Hand で、プレイアウトでは軽い SimHand を使う
         MatchType matchType; // 対戦の種類
         Player myPlayerNum; // 自分のプレーヤー番号
         
@@ -48,11 +87,14 @@ namespace Mahjong{
         
         // 主観的にわからない情報
         Pack128<int32_t, N_PLAYERS> pieces; // 手牌の数(構成がわからなくても枚数さえわかればここに入れる)
-        std::array<Hand, N_PLAYERS> hand; // 各プレーヤーの持ち牌
+        std::array<hand_t, N_PLAYERS> hand; // 各プレーヤーの持ち牌
         std::array<UncertainPieces, N_PLAYERS> uncertain; // 主観的にまだ見えていない牌(各プレーヤーごと)
         Wall wall; // 山
         int wallPieces; // 山牌の数
         
+        // 盤面全体のハッシュ値 試合進行関数で差分更新する
+        uint64_t hashKey;
+        
         Wind playerWind(Player pn)const noexcept{ // プレーヤーpの自風 親なら東(WIND_E)
             return static_cast<Wind>((unsigned int)(pn - owner) % N_PLAYERS) + WIND_E;
         }
@@ -94,10 +136,10 @@ namespace Mahjong{
         bool isInMyReach()const{
             assertMyPlayerNum(); return isInReach(myPlayerNum);
         }
-        Hand& myHand(){
+        hand_t& myHand(){
             assertMyPlayerNum(); return hand[myPlayerNum];
         }
-        const Hand& myHand()const{
+        const hand_t& myHand()const{
             assertMyPlayerNum(); return hand[myPlayerNum];
         }
         UncertainPieces& myUncertain(){
@@ -110,6 +152,7 @@ namespace Mahjong{
         // 試合進行関数
         void reach(Player pn){ // リーチ
             ASSERT(examPlayerNum(pn), cerr << pn << endl;);
+            hashKey += fieldHashTable.reach[pn];
             reachTurn[pn] = turn - 1; // 先にdiscardが呼ばれるので
             reachBonus += 1;
             score[pn] -= SCORE_REACH;
@@ -148,22 +191,36 @@ namespace Mahjong{
                 score[pn] += ds[pn];
             }
         }
+        // ハッシュ値の差分更新
+        void changeTurnPlayer(Player pn)noexcept{
+            hashKey += fieldHashTable.turnPlayer[pn] - fieldHashTable.turnPlayer[turnPlayer];
+            turnPlayer = pn;
+        }
+        void updateConcealedHashKey(Player pn, uint64_t oldKey)noexcept{
+            // 手牌のハッシュキーが oldKey から変わった分
+            hashKey += (hand[pn].pieceHashKey - oldKey) * fieldHashTable.concealed[pn];
+        }
+        void addOpenedHashKey(Player pn, const ExtPieceSet& opened)noexcept{
+            hashKey += getPieceHashKey(opened) * fieldHashTable.opened[pn];
+        }
+        
         void procTurn(Player pn)noexcept{
             turn += 1;
-            turnPlayer = pn;
+            hashKey += fieldHashTable.turn;
+            changeTurnPlayer(pn);
         }
         void procTurn()noexcept{
-            turn += 1;
-            turnPlayer = nextPlayer(turnPlayer);
+            procTurn(nextPlayer(turnPlayer));
         }
         
         void discard(Player pn, ExtPiece ep, bool parrot){ // 牌を捨てる
             //DERR << "player " << pn << " (" << playerWind(turnPlayer) << ") discarded " << ep;
             //DERR << " (" << (parrot ? "drawn" : "hand") << ")" << endl;
             
-            turnPlayer = pn;
+            changeTurnPlayer(pn);
             
             // 捨て牌を追加
+            hashKey += pieceHashTable[ep] * fieldHashTable.discarded[turnPlayer][discards[turnPlayer]];
             discardedSet[turnPlayer] += ep;
             discardedSeq[turnPlayer][discards[turnPlayer]++] = ep;
             
@@ -173,7 +230,9 @@ namespace Mahjong{
                     // 本人の手牌から引く
                     // この時点で引いた牌が加算されている必要がある
                     // リーチのときは加算していないので引かない
+                    const uint64_t oldKey = hand[turnPlayer].pieceHashKey;
                     hand[turnPlayer].subAll(ep);
+                    updateConcealedHashKey(turnPlayer, oldKey);
                 }
             }
             pieces[turnPlayer] -= 1;
@@ -192,40 +251,54 @@ namespace Mahjong{
         
         // チー・ポンは打牌までが同時行動であるが、打牌は後ほど discard() 関数で扱う
         void chow(Player pn, Meld m, ExtPiece picked, const ExtPieceSet& opened){ // チー
+            const uint64_t oldKey = hand[pn].pieceHashKey;
             hand[pn].addOpenedSeq(m, picked, opened); // 役一覧に追加
             if(!examPlayerNum(myPlayerNum) || pn == myPlayerNum){ // 手牌から除く
                 hand[pn].subSeqExceptAll(m.piece(), toPiece(picked), m.red());
             }
+            updateConcealedHashKey(pn, oldKey);
+            addOpenedHashKey(pn, opened);
+            hashKey += pieceHashTable[picked] * fieldHashTable.opened[pn];
+            hashKey += pieceHashTable[m.piece()] * fieldHashTable.openedSeq[pn];
             pieces[pn] -= N_CHOW_PIECES - 1; // 手牌の枚数を引く
             open += opened; // 全体開示牌追加
             pickedSet[pn] += picked; // もらった牌追加
             // 本人以外のuncertainから引く
             for(Player p = 0; p < pn; ++p)uncertain[p] -= opened;
             for(Player p = pn + 1; p < N_PLAYERS; ++p)uncertain[p] -= opened;
-            turnPlayer = nextPlayer(pn); // 次のプレーヤー設定
+            changeTurnPlayer(nextPlayer(pn)); // 次のプレーヤー設定
             lastResponseTurn = turn; // 新しい鳴き
         }
         void pong(Player pn, Meld m, ExtPiece picked, const ExtPieceSet& opened){ // ポン
+            const uint64_t oldKey = hand[pn].pieceHashKey;
             hand[pn].addOpenedGroup(m, picked, opened); // 役一覧に追加
             if(!examPlayerNum(myPlayerNum) || pn == myPlayerNum){ // 手牌から除く
                 hand[pn].subGroupAll(m.piece(), N_PONG_PIECES - 1, m.red());
             }
+            updateConcealedHashKey(pn, oldKey);
+            addOpenedHashKey(pn, opened);
+            hashKey += pieceHashTable[picked] * fieldHashTable.opened[pn];
+            hashKey += pieceHashTable[m.piece()] * fieldHashTable.openedGroup[pn];
             pieces[pn] -= N_PONG_PIECES - 1; // 手牌の枚数を引く
             open += opened; // 全体開示牌追加
             pickedSet[pn] += picked; // もらった牌追加
             // 本人以外のuncertainから引く
             for(Player p = 0; p < pn; ++p)uncertain[p] -= opened;
             for(Player p = pn + 1; p < N_PLAYERS; ++p)uncertain[p] -= opened;
-            turnPlayer = nextPlayer(pn); // 次のプレーヤー設定
+            changeTurnPlayer(nextPlayer(pn)); // 次のプレーヤー設定
             lastResponseTurn = turn; // 新しい鳴き
         }
         
         // カンは一度牌を引くのでカン確定時点までの情報のみ
         void drawKong(Player pn, Meld m, const ExtPieceSet& opened){ // 暗槓 opened に全ての牌が入る
+            const uint64_t oldKey = hand[pn].pieceHashKey;
             hand[pn].addOpenedGroupNoPick(m, opened); // 役一覧に追加
             if(!examPlayerNum(myPlayerNum) || pn == myPlayerNum){ // 手牌から除く
                 hand[pn].subGroupAll(m.piece(), N_KONG_PIECES, m.red());
             }
+            updateConcealedHashKey(pn, oldKey);
+            addOpenedHashKey(pn, opened);
+            hashKey += pieceHashTable[m.piece()] * fieldHashTable.openedGroup[pn];
             pieces[pn] -= N_KONG_PIECES; // 手牌の枚数を引く
             open += opened; // 全体開示牌追加
             // 本人以外のuncertainから引く
@@ -235,10 +308,13 @@ namespace Mahjong{
             lastResponseTurn = turn; // 鳴きではないが地和や一発が崩れる
         }
         void addKong(Player pn, ExtPiece added){ // 小明槓(成立時点)
+            const uint64_t oldKey = hand[pn].pieceHashKey;
             hand[pn].expandOpenedGroup(added); // 牌情報
             if(!examPlayerNum(myPlayerNum) || pn == myPlayerNum){ // 手牌から除く
                 hand[pn].subAll(added);
             }
+            updateConcealedHashKey(pn, oldKey);
+            hashKey += pieceHashTable[added] * fieldHashTable.opened[pn]; // 面子の形は刻子のまま
             pieces[pn] -= 1; // 手牌の枚数を引く
             open += added; // 全体開示牌追加
             // 本人以外のuncertainから引く
@@ -247,10 +323,15 @@ namespace Mahjong{
             lastResponseTurn = turn; // 地和や一発が崩れる
         }
         void responseKong(Player pn, Meld m, ExtPiece picked, const ExtPieceSet& opened){ // 大明槓
+            const uint64_t oldKey = hand[pn].pieceHashKey;
             hand[pn].addOpenedGroup(m, picked, opened); // 役一覧に追加
             if(!examPlayerNum(myPlayerNum) || pn == myPlayerNum){ // 手牌から除く
                 hand[pn].subGroupAll(m.piece(), N_KONG_PIECES - 1, m.red());
             }
+            updateConcealedHashKey(pn, oldKey);
+            addOpenedHashKey(pn, opened);
+            hashKey += pieceHashTable[picked] * fieldHashTable.opened[pn];
+            hashKey += pieceHashTable[m.piece()] * fieldHashTable.openedGroup[pn];
             pieces[pn] -= N_KONG_PIECES - 1; // 手牌の枚数を引く
             open += opened; // 全体開示牌追加
             pickedSet[pn] += picked; // もらった牌追加
@@ -262,6 +343,7 @@ namespace Mahjong{
         }
         void pushDora(ExtPiece adm){ // ドラ表示牌を受け取る
             wall[wallIndexDoraMarker(doras)] = adm; // 山のうちドラ表示牌の場所の牌が確定
+            hashKey += pieceHashTable[adm] * fieldHashTable.dora;
             dora += toNextPiece(toPiece(adm)); // ドラは次の牌
             doras += 1;
             open += adm;
@@ -334,6 +416,8 @@ namespace Mahjong{
             // 同時に明らかになる情報をセット
             wallPieces = N_ALL_PIECES - N_LEFT_PIECES - sumPieces;
             
+            hashKey = calcHashKey();
+            
             DERR << "Field::initGame()" << endl;
             DERR << toDebugString() << endl;
             ASSERT(exam(),);
@@ -342,17 +426,20 @@ namespace Mahjong{
         void setDealt(Player pn, const ExtPieceSet& ps){ // 配牌時の情報設定
             hand[pn].setAll(ps);
             uncertain[pn] = ~ps;
+            hashKey = calcHashKey();
             
             DERR << "Field::setDealt()" << endl;
         }
         void setTurn(Player pn, ExtPiece ep){ // ツモ手番での情報設定
-            turnPlayer = pn;
+            changeTurnPlayer(pn);
             wall[wallIndexTurn(turn)] = ep;
             // この時点で牌を足しておく
             // リーチのときはツモ切りしかできないので足さない
             if(examExtPiece(ep)){ // どの牌かわかる場合
                 if(!isInReach(turnPlayer)){
+                    const uint64_t oldKey = hand[turnPlayer].pieceHashKey;
                     hand[turnPlayer].addAll(ep);
+                    updateConcealedHashKey(turnPlayer, oldKey);
                 }
                 uncertain[turnPlayer] -= ep; // この時点引いた本人のみ情報を得る
             }
@@ -446,6 +533,33 @@ namespace Mahjong{
             return oss.str();
         }
         
+        uint64_t calcHashKey()const{
+            // 盤面からハッシュ値を計算し直す
+            // 手牌を直接設定した後(世界生成など)と差分更新の確認に使う
+            uint64_t key = fieldHashTable.turn * turn + fieldHashTable.turnPlayer[turnPlayer];
+            for(Player pn = 0; pn < N_PLAYERS; ++pn){
+                const hand_t& h = hand[pn];
+                key += h.pieceHashKey * fieldHashTable.concealed[pn];
+                key += getPieceHashKey(h.openedPiece) * fieldHashTable.opened[pn];
+                iteratePieceWithQty(h.openedSeqQr, [&key, pn](Piece p, int q)->void{
+                    key += pieceHashTable[p] * q * fieldHashTable.openedSeq[pn];
+                });
+                iterate(h.openedGroupAll(), [&key, pn](int index)->void{
+                    key += pieceHashTable[index] * fieldHashTable.openedGroup[pn];
+                });
+                if(isInReach(pn)){
+                    key += fieldHashTable.reach[pn];
+                }
+                for(int i = 0; i < discards[pn]; ++i){
+                    key += pieceHashTable[discardedSeq[pn][i]] * fieldHashTable.discarded[pn][i];
+                }
+            }
+            for(int d = 0; d < doras; ++d){
+                key += pieceHashTable[wall[wallIndexDoraMarker(d)]] * fieldHashTable.dora;
+            }
+            return key;
+        }
+        
         // 以下validation
         bool examPlayersInfo(Player pn)const{
             if(!hand[pn].exam()){
@@ -544,10 +658,10 @@ namespace Mahjong{
             // 手牌の枚数チェック(主観的なときは自分のみ)
             if(examPlayerNum(myPlayerNum)){
                 const int okDiff = isInMyReach() ? 1 : 0;
-                int diff = pieces[myPlayerNum] - myHand().allPieces;
+                int diff = pieces[myPlayerNum] - int(myHand().piece.sum());
                 if(!(0 <= diff && diff <= okDiff)){
                     cerr << "Field::exam() : " << "inconsistent my num of pieces ";
-                    cerr << myHand().allPieces << " (hand) ";
+                    cerr << myHand().piece.sum() << " (hand) ";
                     cerr << " <-> " << pieces[myPlayerNum] << " (num of pieces)" << endl;
                     return false;
                 }
@@ -565,9 +679,18 @@ namespace Mahjong{
             if(!exam()){ return false; }
             return true;
         }
+        bool examHashKey()const{
+            const uint64_t key = calcHashKey();
+            if(hashKey != key){
+                cerr << "Field::examHashKey() : inconsistent hash key " << hashKey << " <-> " << key << endl;
+                return false;
+            }
+            return true;
+        }
         bool examInSimulation()const{
             // シミュレーション中 不完全情報を設定しているのでその部分もチェック
             if(!examSettledPieces()){ return false; }
+            if(!examHashKey()){ return false; }
             if(!exam()){ return false; }
             return true;
         }
@@ -575,8 +698,263 @@ namespace Mahjong{
         void assertMyPlayerNum()const{
             ASSERT(examPlayerNum(myPlayerNum), cerr << myPlayerNum << endl;);
         }
+        
+        template<class other_hand_t>
+        void setFrom(const FieldBase<other_hand_t>& f){
+            // 手牌の型が違う盤面からのコピー
+            matchType = f.matchType;
+            myPlayerNum = f.myPlayerNum;
+            games = f.games;
+            rounds = f.rounds;
+            score = f.score;
+            position = f.position;
+            invPosition = f.invPosition;
+            fieldWind = f.fieldWind;
+            repetitionBonus = f.repetitionBonus;
+            reachBonus = f.reachBonus;
+            owner = f.owner;
+            turn = f.turn;
+            lastResponseTurn = f.lastResponseTurn;
+            reachTurn = f.reachTurn;
+            reaches = f.reaches;
+            turnPlayer = f.turnPlayer;
+            pickedSet = f.pickedSet;
+            discardedSet = f.discardedSet;
+            discardedSeq = f.discardedSeq;
+            discards = f.discards;
+            open = f.open;
+            dora = f.dora;
+            doras = f.doras;
+            kongs = f.kongs;
+            pieces = f.pieces;
+            for(Player pn = 0; pn < N_PLAYERS; ++pn){
+                hand[pn].set(f.hand[pn]);
+            }
+            uncertain = f.uncertain;
+            wall = f.wall;
+            wallPieces = f.wallPieces;
+            hashKey = f.hashKey;
+        }
     };
     
+    using Field = FieldBase<Hand>;
+    using SimField = FieldBase<SimHand>; // プレイアウト用
+    
+    /**************************盤面の巻き戻し**************************/
+    
+    // 盤面全体をコピーしないための差分記録付き盤面
+    // 試合進行関数で書き換えたプレーヤーごとの情報を記録しておき、
+    // rollback() で根の盤面からその部分だけを書き戻す
+    // 手数や得点などの小さい値と山の引かれた部分は記録せずに常に書き戻す
+    // 局の終わりまで進むプレイアウトでは殆ど全てを書き戻すことになり、コピーより遅いのでそちらでは使わない
+    // FieldBase は private に継承し、FieldBase の参照やポインタを通して記録せずに書き換えることはできないようにする
+    // 記録で管理するプレーヤーごとの情報と山は const の参照としてのみ公開し、書き換えは記録付きの試合進行関数に限る
+    // それ以外に公開する値は rollback() で常に書き戻すので、直接書き換えても巻き戻しは壊れない
+    
+    enum JournalIndex{
+        JOURNAL_HAND = 0,
+        JOURNAL_UNCERTAIN = N_PLAYERS,
+        JOURNAL_DISCARDED = N_PLAYERS * 2,
+        JOURNAL_PICKED = N_PLAYERS * 3,
+    };
+    
+    template<class hand_t>
+    struct JournaledFieldBase : private FieldBase<hand_t>{
+        using base_t = FieldBase<hand_t>;
+        
+        // 盤面データ
+        using base_t::matchType;
+        using base_t::myPlayerNum;
+        using base_t::games;
+        using base_t::rounds;
+        using base_t::score;
+        using base_t::position;
+        using base_t::invPosition;
+        using base_t::fieldWind;
+        using base_t::repetitionBonus;
+        using base_t::reachBonus;
+        using base_t::owner;
+        using base_t::turn;
+        using base_t::lastResponseTurn;
+        using base_t::reachTurn;
+        using base_t::reaches;
+        using base_t::turnPlayer;
+        using base_t::discards;
+        using base_t::open;
+        using base_t::dora;
+        using base_t::doras;
+        using base_t::kongs;
+        using base_t::pieces;
+        using base_t::wallPieces;
+        using base_t::hashKey;
+        
+        // 参照用の関数
+        using base_t::playerWind;
+        using base_t::windPlayer;
+        using base_t::isInReach;
+        using base_t::isAllReach;
+        using base_t::isConcealed;
+        using base_t::isImmediate;
+        using base_t::isLastTurn;
+        using base_t::isFirstTurn;
+        using base_t::isReachable;
+        using base_t::lastDiscarded;
+        using base_t::toCommonString;
+        using base_t::toString;
+        using base_t::toDebugString;
+        using base_t::calcHashKey;
+        using base_t::exam;
+        using base_t::examHashKey;
+        using base_t::examInSimulation;
+        
+        // rollback() で常に書き戻す値だけを変える関数
+        using base_t::reach;
+        using base_t::declareReach;
+        using base_t::switchOwner;
+        using base_t::drawToLeaveOwner;
+        using base_t::drawToSwitchOwner;
+        using base_t::winToLeaveOwner;
+        using base_t::winToSwitchOwner;
+        using base_t::feedDiffScore;
+        using base_t::procTurn;
+        using base_t::setPosition;
+        
+        // 記録で管理する盤面データ (読み取り専用)
+        const decltype(base_t::pickedSet)& pickedSet = base_t::pickedSet;
+        const decltype(base_t::discardedSet)& discardedSet = base_t::discardedSet;
+        const decltype(base_t::discardedSeq)& discardedSeq = base_t::discardedSeq;
+        const decltype(base_t::hand)& hand = base_t::hand;
+        const decltype(base_t::uncertain)& uncertain = base_t::uncertain;
+        const decltype(base_t::wall)& wall = base_t::wall;
+        
+        BitSet32 journal; // 根から書き換えた情報 (JournalIndex + プレーヤー番号)
+        
+        JournaledFieldBase() = default;
+        JournaledFieldBase(const JournaledFieldBase& f): // 参照は自分の盤面を指したままにする
+        base_t(f), journal(f.journal){}
+        JournaledFieldBase& operator =(const JournaledFieldBase& f){
+            base_t::operator =(f);
+            journal = f.journal;
+            return *this;
+        }
+        
+        const base_t& base()const noexcept{ // 読み取り専用の盤面として渡す
+            return *this;
+        }
+        
+        void setRoot(const base_t& root){ // 根の盤面から開始
+            base_t::operator =(root);
+            journal = 0;
+        }
+        void rollback(const base_t& root){ // 根の盤面に戻す
+            // 山はツモとドラ表示で確定した位置のみ
+            const int lastTurn = this->turn < N_TURNS ? this->turn : (N_TURNS - 1);
+            for(int t = root.turn; t <= lastTurn; ++t){
+                base_t::wall[wallIndexTurn(t)] = root.wall[wallIndexTurn(t)];
+            }
+            for(int d = root.doras; d < this->doras; ++d){
+                base_t::wall[wallIndexDoraMarker(d)] = root.wall[wallIndexDoraMarker(d)];
+            }
+            for(Player pn = 0; pn < N_PLAYERS; ++pn){
+                if(journal.test(JOURNAL_HAND + pn)){
+                    base_t::hand[pn] = root.hand[pn];
+                }
+                if(journal.test(JOURNAL_UNCERTAIN + pn)){
+                    base_t::uncertain[pn] = root.uncertain[pn];
+                }
+                if(journal.test(JOURNAL_DISCARDED + pn)){
+                    base_t::discardedSet[pn] = root.discardedSet[pn];
+                    base_t::discardedSeq[pn] = root.discardedSeq[pn];
+                }
+                if(journal.test(JOURNAL_PICKED + pn)){
+                    base_t::pickedSet[pn] = root.pickedSet[pn];
+                }
+            }
+            journal = 0;
+            
+            this->games = root.games;
+            this->rounds = root.rounds;
+            this->score = root.score;
+            this->position = root.position;
+            this->invPosition = root.invPosition;
+            this->fieldWind = root.fieldWind;
+            this->repetitionBonus = root.repetitionBonus;
+            this->reachBonus = root.reachBonus;
+            this->owner = root.owner;
+            this->turn = root.turn;
+            this->lastResponseTurn = root.lastResponseTurn;
+            this->reachTurn = root.reachTurn;
+            this->reaches = root.reaches;
+            this->turnPlayer = root.turnPlayer;
+            this->discards = root.discards;
+            this->open = root.open;
+            this->dora = root.dora;
+            this->doras = root.doras;
+            this->kongs = root.kongs;
+            this->pieces = root.pieces;
+            this->wallPieces = root.wallPieces;
+            this->hashKey = root.hashKey;
+        }
+        
+        // 試合進行関数
+        // 書き換える情報を記録してから盤面の関数を呼ぶ
+        void setTurn(Player pn, ExtPiece ep){
+            journal.set(JOURNAL_HAND + pn);
+            journal.set(JOURNAL_UNCERTAIN + pn);
+            base_t::setTurn(pn, ep);
+        }
+        void discard(Player pn, ExtPiece ep, bool parrot){
+            journal.set(JOURNAL_HAND + pn);
+            journal.set(JOURNAL_DISCARDED + pn);
+            recordOthersUncertain(pn);
+            base_t::discard(pn, ep, parrot);
+        }
+        void chow(Player pn, Meld m, ExtPiece picked, const ExtPieceSet& opened){
+            recordMeld(pn);
+            base_t::chow(pn, m, picked, opened);
+        }
+        void pong(Player pn, Meld m, ExtPiece picked, const ExtPieceSet& opened){
+            recordMeld(pn);
+            base_t::pong(pn, m, picked, opened);
+        }
+        void drawKong(Player pn, Meld m, const ExtPieceSet& opened){
+            journal.set(JOURNAL_HAND + pn);
+            recordOthersUncertain(pn);
+            base_t::drawKong(pn, m, opened);
+        }
+        void addKong(Player pn, ExtPiece added){
+            journal.set(JOURNAL_HAND + pn);
+            recordOthersUncertain(pn);
+            base_t::addKong(pn, added);
+        }
+        void responseKong(Player pn, Meld m, ExtPiece picked, const ExtPieceSet& opened){
+            recordMeld(pn);
+            base_t::responseKong(pn, m, picked, opened);
+        }
+        void pushDora(ExtPiece adm){
+            for(Player p = 0; p < N_PLAYERS; ++p){
+                journal.set(JOURNAL_UNCERTAIN + p);
+            }
+            base_t::pushDora(adm);
+        }
+        
+    private:
+        void recordOthersUncertain(Player pn){
+            for(Player p = 0; p < N_PLAYERS; ++p){
+                if(p != pn){
+                    journal.set(JOURNAL_UNCERTAIN + p);
+                }
+            }
+        }
+        void recordMeld(Player pn){
+            journal.set(JOURNAL_HAND + pn);
+            journal.set(JOURNAL_PICKED + pn);
+            recordOthersUncertain(pn);
+        }
+    };
+    
+    using JournaledSimField = JournaledFieldBase<SimHand>; // 巻き戻し付きプレイアウト用
+    
     struct FieldTemporalInfo{
         // 場の状態を一時的に保存するためのクラス
         bool afterKong;
@@ -14,6 +14,113 @@
 
 namespace Mahjong{
 
+    /**************************シャンテン数キャッシュ**************************/
+    
+    // 手牌のハッシュキーと副露数からシャンテン数と受け入れ牌を引く固定サイズのキャッシュ
+    // プロセス内の探索スレッドで共有し、ロックは使わない
+    // エントリは (キー ^ データ, データ) の2語で、片方だけ書き換わった途中の状態はキーが合わず外れになる
+    // データは 受け入れ牌(55ビット) | (シャンテン数 + 2) << 56 で、空のエントリ(0)とは区別できる
+    
+    constexpr int STEPS_CACHE_SIZE_LOG2 = 18; // 4MB
+    constexpr uint64_t STEPS_CACHE_SIZE = 1ULL << STEPS_CACHE_SIZE_LOG2;
+    constexpr int STEPS_CACHE_DATA_SHIFT = 56;
+    constexpr uint64_t STEPS_CACHE_OPENED_SALT = 0x9e3779b97f4a7c15ULL;
+    
+    struct StepsCacheEntry{
+        std::atomic<uint64_t> check;
+        std::atomic<uint64_t> data;
+    };
+    
+    // 統計はスレッドごとのスロットに数え、表示する時だけ合計する
+    // 1スロットは1スレッドしか書かない前提で、lock 付きの加算は使わない
+    // (スレッド数がスロット数を超えると共有されて数え落としが出るが、統計なので許す)
+    constexpr int N_STEPS_CACHE_STAT_SLOTS = 64;
+    
+    struct alignas(64) StepsCacheStatSlot{
+        std::atomic<uint64_t> probes;
+        std::atomic<uint64_t> hits;
+        
+        static void increment(std::atomic<uint64_t>& a)noexcept{
+            a.store(a.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+    };
+    
+    std::atomic<int> stepsCacheStatThreads(0);
+    
+    inline int stepsCacheStatSlotIndex()noexcept{
+        thread_local const int index = stepsCacheStatThreads.fetch_add(1, std::memory_order_relaxed) % N_STEPS_CACHE_STAT_SLOTS;
+        return index;
+    }
+    
+    struct StepsCache{
+        StepsCacheEntry entry[STEPS_CACHE_SIZE];
+        StepsCacheStatSlot stat[N_STEPS_CACHE_STAT_SLOTS];
+        
+        static uint64_t toKey(uint64_t pieceHashKey, int opened)noexcept{
+            return pieceHashKey + opened * STEPS_CACHE_OPENED_SALT;
+        }
+        StepsCacheEntry& at(uint64_t key)noexcept{
+            return entry[(key >> (64 - STEPS_CACHE_SIZE_LOG2)) & (STEPS_CACHE_SIZE - 1)];
+        }
+        bool probe(uint64_t key, int *const psteps, PieceExistance *const pac)noexcept{
+            StepsCacheEntry& e = at(key);
+            const uint64_t data = e.data.load(std::memory_order_relaxed);
+            const uint64_t check = e.check.load(std::memory_order_relaxed);
+            StepsCacheStatSlot& st = stat[stepsCacheStatSlotIndex()];
+            StepsCacheStatSlot::increment(st.probes);
+            if((check ^ data) != key || data == 0){ return false; }
+            StepsCacheStatSlot::increment(st.hits);
+            *psteps = int(data >> STEPS_CACHE_DATA_SHIFT) - 2;
+            *pac = PieceExistance(data & ((1ULL << STEPS_CACHE_DATA_SHIFT) - 1));
+            return true;
+        }
+        void store(uint64_t key, int steps, const PieceExistance& ac)noexcept{
+            const uint64_t data = uint64_t(ac) | (uint64_t(steps + 2) << STEPS_CACHE_DATA_SHIFT);
+            StepsCacheEntry& e = at(key);
+            e.check.store(key ^ data, std::memory_order_relaxed);
+            e.data.store(data, std::memory_order_relaxed);
+        }
+        void clear()noexcept{
+            for(StepsCacheEntry& e : entry){
+                e.check.store(0, std::memory_order_relaxed);
+                e.data.store(0, std::memory_order_relaxed);
+            }
+            clearStats();
+        }
+        void clearStats()noexcept{
+            for(StepsCacheStatSlot& st : stat){
+                st.probes.store(0, std::memory_order_relaxed);
+                st.hits.store(0, std::memory_order_relaxed);
+            }
+        }
+        uint64_t probes()const noexcept{
+            uint64_t n = 0;
+            for(const StepsCacheStatSlot& st : stat){ n += st.probes.load(std::memory_order_relaxed); }
+            return n;
+        }
+        uint64_t hits()const noexcept{
+            uint64_t n = 0;
+            for(const StepsCacheStatSlot& st : stat){ n += st.hits.load(std::memory_order_relaxed); }
+            return n;
+        }
+        double hitRate()const{
+            const uint64_t p = probes();
+            return p == 0 ? 0 : hits() / double(p);
+        }
+    };
+    
+    StepsCache stepsCache; // 静的領域なので0で初期化されている
+    
+    template<class hand_t>
+    int calcMinimumStepsCached(const hand_t& hand, PieceExistance *const pac){
+        const uint64_t key = StepsCache::toKey(hand.pieceHashKey, hand.openedMelds());
+        int steps;
+        if(stepsCache.probe(key, &steps, pac)){ return steps; }
+        steps = calcMinimumSteps(hand, pac);
+        stepsCache.store(key, steps, *pac);
+        return steps;
+    }
+    
     /**************************詳しい牌情報**************************/
 
     // 1人の牌情報
@@ -55,6 +162,7 @@ namespace Mahjong{
         // 鳴きによって完成しているgroup 3 or 4 なのでこれで十分だろう
         static constexpr int kGroupSizePatterns = N_ONE_PIECE - N_MIN_OPENED_GROUP_PIECES + 1;
         std::array<PieceExistance, kGroupSizePatterns> openedGroup;
+        PieceExistance concealedKong; // openedGroup[1] のうち暗槓のもの(暗刻として数える)
         PieceSet4 openedSeqQr; // 鳴きによって完成しているsequenceのQR
         int openedGroups, openedSeqs; // 数
         int numPicked; // 鳴いた数(門前判定に利用)
@@ -104,23 +212,27 @@ namespace Mahjong{
             return piece.red();
         }
         
+        // シャンテン数計算
+        int calcMinimumStepsCached(PieceExistance *const pac)const{ // SimHand と同じ形で呼べるように
+            return Mahjong::calcMinimumStepsCached(*this, pac);
+        }
         void setStepInfo(){
-            minimumSteps = calcMinimumSteps(*this, &acceptable);
+            minimumSteps = calcMinimumStepsCached(&acceptable);
         }
         
         // 設定関数 遅いので毎回呼ぶのは厳禁
         void setConcealedInfo(const ExtPieceSet4& eps,
                               BitArray32<8, N_PIECE_TYPES> apieces, uint32_t apiecesSum)noexcept{
             piece = eps;
+            // pqr, scを設定
+            pqr = convQR_PQR(eps);
+            sc = convPQR_SC(pqr);
             existance.reset();
             for(PieceType pt = PIECE_TYPE_MIN; pt <= PIECE_TYPE_MAX; ++pt){
                 pieceMin[pt].set(eps[pt]); // pieceMinを設定(遅い)
-                existance |= pext(sc[pt], PQR_1) << toPiece(pt, RANK_MIN); // 存在型を設定
+                existance |= pext(sc[pt], PQR_1) << toPiece(pt, RANK_MIN); // 存在型を設定(新しい sc から)
             }
             runExistance = existance & (existance >> 1) & (existance >> 2); // 階段存在型を設定
-            // pqr, scを設定
-            pqr = convQR_PQR(eps);
-            sc = convPQR_SC(pqr);
             pieces = apieces;
             allPieces = apiecesSum;
         }
@@ -201,15 +313,15 @@ namespace Mahjong{
             const Rank r = toRank(p);
             
             if(!piece.contains(p)){ // 元々同じ牌はなかった
-                pqr[pt] |= 1ULL << ((r << 2) + n);
-                sc[pt]  |= ((1ULL << (n + 1)) - 1) << (r << 2);
+                pqr[pt] |= 1ULL << ((r << 2) + n - 1);
+                sc[pt]  |= ((1ULL << n) - 1) << (r << 2);
                 existance.set(p);
                 runExistance = existance & (existance >> 1) & (existance >> 2);
             }else{ // あった
                 const uint64_t rankMask = 15ULL << (r << 2);
                 const uint64_t dpqr = ((pqr[pt] & rankMask) << n);
                 pqr[pt] = (pqr[pt] & ~rankMask) | ((pqr[pt] & rankMask) << n);
-                sc[pt]  |= ((1ULL << (piece[p] + n + 1)) - 1) << (r << 2);
+                sc[pt]  |= ((1ULL << (piece[p] + n)) - 1) << (r << 2);
             }
             piece.add(p, n, red);
             pieceMin.add(p, n);
@@ -334,7 +446,7 @@ namespace Mahjong{
                 runExistance = existance & (existance >> 1) & (existance >> 2);
             }else{ // まだある
                 pqr[pt] = (pqr[pt] & ~rankMask) | ((pqr[pt] & rankMask) >> n);
-                sc[pt]  = (sc[pt]  & ~rankMask) | ((sc[pt]  & rankMask) >> n);
+                sc[pt]  = (sc[pt]  & ~rankMask) | (((sc[pt]  & rankMask) >> n) & rankMask); // 下の位に溢れさせない
             }
             pieces.subtr(pt, n);
             allPieces -= n;
@@ -417,7 +529,7 @@ namespace Mahjong{
             numPicked += 1;
         }
         void addOpenedGroup(Meld m, ExtPiece picked, const ExtPieceSet& opened){
-            openedGroup[m.qty() - N_MIN_OPENED_GROUP_PIECES].set(picked);
+            openedGroup[m.qty() - N_MIN_OPENED_GROUP_PIECES].set(m.piece());
             openedPiece += opened;
             openedPiece += picked;
             openedGroups += 1;
@@ -438,12 +550,14 @@ namespace Mahjong{
         void addOpenedGroupNoPick(Meld m, const ExtPieceSet& opened){
             // 全ての牌が一括で与えられる暗槓の場合
             openedGroup[m.qty() - N_MIN_OPENED_GROUP_PIECES].set(m.piece());
+            concealedKong.set(m.piece());
             openedPiece += opened;
             openedGroups += 1;
         }
         void addOpenedGroupNoPick(Meld m){
             // 全ての牌が一括で与えられる暗槓の場合
             openedGroup[m.qty() - N_MIN_OPENED_GROUP_PIECES].set(m.piece());
+            concealedKong.set(m.piece());
             openedPiece.add(m.piece(), m.qty(), m.red());
             openedGroups += 1;
         }
@@ -462,6 +576,7 @@ namespace Mahjong{
         }
         void subOpenedGroupNoPick(Meld m){
             openedGroup[m.qty() - N_MIN_OPENED_GROUP_PIECES].reset(m.piece());
+            concealedKong.reset(m.piece());
             openedPiece.sub(m.piece(), m.qty(), m.red());
             openedGroups -= 1;
         }
@@ -528,6 +643,7 @@ namespace Mahjong{
             openedSeqs = openedGroups = numPicked = 0;
             openedPiece.clear();
             openedGroup.fill(PieceExistance(0));
+            concealedKong.reset();
             openedSeqQr.clear();
             openedHashKey = OPENED_HASH_NULL;
         }
@@ -616,6 +732,11 @@ namespace Mahjong{
                 cerr << openedGroups << " <-> " << "3: " << openedGroup[0] << " 4: " << openedGroup[1] << endl;
                 return false;
             }
+            if(uint64_t(concealedKong) & ~uint64_t(openedGroup[1])){
+                cerr << "Hand::examOpenedGroup() : concealed kong should be in group4" << endl;
+                cerr << "4: " << openedGroup[1] << " concealed: " << concealedKong << endl;
+                return false;
+            }
             return true;
         }
         bool examConcealedInfo()const{
@@ -685,7 +806,12 @@ namespace Mahjong{
     };
     
     void subAll(Hand *const phand, ExtPiece ep, const NextHandInfo& ni){
-        
+        // 検討済みの打牌を実際に行う
+        // シャンテン数と受け入れは検討時の値を使い、再計算しない
+        phand->sub(ep);
+        phand->pieceHashKey -= pieceHashTable[ep];
+        phand->minimumSteps = ni.minimumSteps;
+        phand->acceptable = ni.acceptable;
     }
     
     /**************************手牌情報を巻き戻すための一時情報**************************/
@@ -698,29 +824,315 @@ namespace Mahjong{
     // 周囲の情報(元のまま)と合わせて利用する情報のみこちらに記録する
     
     struct DiffHandInfo{
-        uint32_t minimumStepsInfo;
+        ExtPiece piece; // subTempAll() で抜いた牌
+        int minimumSteps;
+        BitSet64 acceptable;
+        std::array<uint32_t, N_NUMBER_PIECE_TYPES> minimumStepsInfo;
+        uint64_t pieceHashKey;
+    };
+    
+    void storeDiffHandInfo(const Hand& hand, DiffHandInfo *const pdi){
+        pdi->minimumSteps = hand.minimumSteps;
+        pdi->acceptable = hand.acceptable;
+        pdi->minimumStepsInfo = hand.minimumStepsInfo;
+        pdi->pieceHashKey = hand.pieceHashKey;
+    }
+    void restoreDiffHandInfo(Hand *const phand, const DiffHandInfo& di){
+        phand->minimumSteps = di.minimumSteps;
+        phand->acceptable = di.acceptable;
+        phand->minimumStepsInfo = di.minimumStepsInfo;
+        phand->pieceHashKey = di.pieceHashKey;
+    }
+    
+    template<class hand_t>
+    void unsubAll(hand_t *const phand, const DiffHandInfo& di){
+        // subTempAll() で抜いた牌を戻す 計算済みの情報は記録から戻すだけ
+        phand->add(di.piece);
+        restoreDiffHandInfo(phand, di);
+    }
+    
+    template<class hand_t>
+    void subTempAll(hand_t *const phand, ExtPiece ep, DiffHandInfo *const pdi, NextHandInfo *const pni){
+        // 打牌の検討用に一時的に牌を抜く
+        // 抜いた後のシャンテン数と受け入れは NextHandInfo に入れ、手牌の値は元のままにしておく
+        storeDiffHandInfo(*phand, pdi);
+        pdi->piece = ep;
+        phand->sub(ep);
+        phand->pieceHashKey -= pieceHashTable[ep];
+        pni->minimumSteps = phand->calcMinimumStepsCached(&pni->acceptable);
+    }
+    
+    /**************************シミュレーション用の手牌**************************/
+    
+    // プレイアウトでは世界ごと、候補行動ごとに盤面を丸ごとコピーするので手牌は小さい方が良い
+    // 牌の枚数と赤(piece)、シャンテン数表の添字(pieceMin)、鳴いた面子、シャンテン数と受け入れだけを持ち
+    // pqr, sc 等の派生情報は必要になったときに piece から作る
+    // 上がりの評価など Hand の全情報が要る処理では toHand() で変換して使う
+    
+    struct SimHandView{
+        // シャンテン数計算で参照する形 SimHand から作る
+        PieceSetMin pieceMin;
+        PieceSet4 pqr, sc;
+        int opened;
         
+        int openedMelds()const noexcept{ return opened; }
     };
     
-    void unsubAll(Hand *const phand, const DiffHandInfo& di){
+    struct SimHand{
         
+        // 1. 手牌の情報
+        ExtPieceSet piece; // 手牌一覧
+        PieceSetMin pieceMin; // シャンテン数表の添字
+        uint64_t pieceHashKey; // 手牌のハッシュキー
+        
+        // 2. オープンな組牌の情報
+        ExtPieceSet openedPiece; // 鳴きによって確定した牌一覧(ドラ、赤の数え上げ用)
+        std::array<PieceExistance, Hand::kGroupSizePatterns> openedGroup;
+        PieceExistance concealedKong; // 暗槓
+        PieceSet4 openedSeqQr;
+        int16_t melds; // 鳴いた役の総数
+        int16_t numPicked; // 鳴いた数(門前判定に利用)
+        
+        // 3. ゲームに関わる発展的情報
+        int minimumSteps; // シャンテン数
+        BitSet64 acceptable; // 受け入れ牌ビット
+        
+        // 性質アクセス
+        bool isFishing()const noexcept{ return minimumSteps == 0; }
+        int openedMelds()const noexcept{ return melds; }
+        bool isConcealed()const noexcept{ return numPicked == 0; }
+        bool isAcceptable(Piece p)const noexcept{ return acceptable.test(p); }
+        PieceExistance openedGroupAll()const noexcept{
+            return openedGroup[0] | openedGroup[1];
+        }
+        bool hasOpenedGroup(Piece p)const noexcept{
+            return openedGroupAll().test(p);
+        }
+        int countAllReds()const noexcept{
+            return countBits(piece.red() | openedPiece.red());
+        }
+        int operator [](Piece p)const{
+            ASSERT(examPiece(p), cerr << (int)p << endl;);
+            return piece[p];
+        }
+        
+        // シャンテン数計算
+        SimHandView view()const{
+            SimHandView v;
+            v.pieceMin = pieceMin;
+            for(PieceType pt = PIECE_TYPE_MIN; pt <= PIECE_TYPE_MAX; ++pt){
+                v.pqr[pt] = convQR_PQR(piece[pt]);
+                v.sc[pt] = convPQR_SC(v.pqr[pt]);
+            }
+            v.opened = openedMelds();
+            return v;
+        }
+        int calcMinimumStepsCached(PieceExistance *const pac)const{
+            // 置換表に当たれば pqr, sc を作らずに済む
+            const uint64_t key = StepsCache::toKey(pieceHashKey, openedMelds());
+            int steps;
+            if(stepsCache.probe(key, &steps, pac)){ return steps; }
+            steps = calcMinimumSteps(view(), pac);
+            stepsCache.store(key, steps, *pac);
+            return steps;
+        }
+        void setStepInfo(){
+            minimumSteps = calcMinimumStepsCached(&acceptable);
+        }
+        
+        // 加減算関数 Hand と同じ名前で、piece と pieceMin だけを更新する
+        void add(ExtPiece ep){
+            piece += ep;
+            pieceMin += toPiece(ep);
+        }
+        void addGroup(Piece p, int n, bool red){
+            piece.add(p, n, red);
+            pieceMin.add(p, n);
+        }
+        void addSeqExcept(Piece p, Piece ex, bool red){
+            piece.addSeqExcept<N_CHOW_PIECES>(p, ex, red);
+            pieceMin.addSeqExcept<N_CHOW_PIECES>(p, ex);
+        }
+        void sub(ExtPiece ep){
+            piece -= ep;
+            pieceMin -= toPiece(ep);
+        }
+        void subGroup(Piece p, int n, bool red){
+            piece.sub(p, n, red);
+            pieceMin.sub(p, n);
+        }
+        void subSeqExcept(Piece p, Piece ex, bool red){
+            piece.subSeqExcept<N_CHOW_PIECES>(p, ex, red);
+            pieceMin.subSeqExcept<N_CHOW_PIECES>(p, ex);
+        }
+        
+        void addAll(ExtPiece ep){
+            add(ep);
+            pieceHashKey += pieceHashTable[ep];
+            setStepInfo();
+        }
+        void subAll(ExtPiece ep){
+            sub(ep);
+            pieceHashKey -= pieceHashTable[ep];
+            setStepInfo();
+        }
+        void subGroupAll(Piece p, int n, bool red){
+            subGroup(p, n, red);
+            pieceHashKey -= pieceHashTable[p] * (n - 1) + pieceHashTable[toExtPiece(p, red)];
+            setStepInfo();
+        }
+        void subSeqExceptAll(Piece p, Piece ex, bool red){
+            subSeqExcept(p, ex, red);
+            pieceHashKey -= seqPieceHashTable[toExtPiece(p, red)];
+            pieceHashKey += pieceHashTable[toExtPiece(ex, red)];
+            setStepInfo();
+        }
+        
+        // 鳴いた役の更新関数
+        void addOpenedSeq(Meld m, ExtPiece picked, const ExtPieceSet& opened){
+            openedSeqQr += m.piece();
+            openedPiece += opened;
+            openedPiece += picked;
+            melds += 1;
+            numPicked += 1;
+        }
+        void addOpenedGroup(Meld m, ExtPiece picked, const ExtPieceSet& opened){
+            openedGroup[m.qty() - N_MIN_OPENED_GROUP_PIECES].set(m.piece());
+            openedPiece += opened;
+            openedPiece += picked;
+            melds += 1;
+            numPicked += 1;
+        }
+        void addOpenedGroupNoPick(Meld m, const ExtPieceSet& opened){
+            openedGroup[m.qty() - N_MIN_OPENED_GROUP_PIECES].set(m.piece());
+            concealedKong.set(m.piece());
+            openedPiece += opened;
+            melds += 1;
+        }
+        void addOpenedGroupNoPick(Meld m){
+            openedGroup[m.qty() - N_MIN_OPENED_GROUP_PIECES].set(m.piece());
+            concealedKong.set(m.piece());
+            openedPiece.add(m.piece(), m.qty(), m.red());
+            melds += 1;
+        }
+        void subOpenedGroup(Meld m){
+            openedGroup[m.qty() - N_MIN_OPENED_GROUP_PIECES].reset(m.piece());
+            openedPiece.sub(m.piece(), m.qty(), m.red());
+            melds -= 1;
+            numPicked -= 1;
+        }
+        void subOpenedGroupNoPick(Meld m){
+            openedGroup[m.qty() - N_MIN_OPENED_GROUP_PIECES].reset(m.piece());
+            concealedKong.reset(m.piece());
+            openedPiece.sub(m.piece(), m.qty(), m.red());
+            melds -= 1;
+        }
+        void expandOpenedGroup(ExtPiece added){
+            openedGroup[0].flip(toPiece(added));
+            openedGroup[1].flip(toPiece(added));
+            openedPiece += added;
+        }
+        void reduceOpenedGroup(ExtPiece subtracted){
+            openedGroup[0].flip(toPiece(subtracted));
+            openedGroup[1].flip(toPiece(subtracted));
+            openedPiece -= subtracted;
+        }
+        
+        // Hand との変換
+        void set(const Hand& hand){
+            piece = hand.piece;
+            pieceMin = hand.pieceMin;
+            pieceHashKey = hand.pieceHashKey;
+            openedPiece = hand.openedPiece;
+            openedGroup = hand.openedGroup;
+            concealedKong = hand.concealedKong;
+            openedSeqQr = hand.openedSeqQr;
+            melds = hand.openedMelds();
+            numPicked = hand.numPicked;
+            minimumSteps = hand.minimumSteps;
+            acceptable = hand.acceptable;
+        }
+        void toHand(Hand *const phand)const{
+            phand->setConcealedInfo(piece);
+            phand->pieceHashKey = pieceHashKey;
+            phand->clearOpenedInfo();
+            phand->openedPiece = openedPiece;
+            phand->openedGroup = openedGroup;
+            phand->concealedKong = concealedKong;
+            phand->openedSeqQr = openedSeqQr;
+            phand->openedGroups = openedGroupAll().count();
+            phand->openedSeqs = melds - phand->openedGroups;
+            phand->numPicked = numPicked;
+            phand->minimumSteps = minimumSteps;
+            phand->acceptable = acceptable;
+        }
+        
+        PieceSet naive()const noexcept{
+            return PieceSet(piece);
+        }
+        bool exam()const{
+            Hand tmp;
+            toHand(&tmp);
+            if(tmp.openedMelds() != melds){
+                cerr << "SimHand::exam() : inconsistent melds " << melds << " <-> " << tmp.openedMelds() << endl;
+                return false;
+            }
+            return tmp.exam();
+        }
+        std::string toString()const{
+            Hand tmp;
+            toHand(&tmp);
+            return tmp.toString();
+        }
+    };
+    
+    std::ostream& operator <<(std::ostream& ost, const SimHand& hand){
+        ost << hand.toString();
+        return ost;
     }
     
-    void subTempAll(Hand *const phand, DiffHandInfo *const pdi, NextHandInfo *const pni){
-        
+    const Hand& toFullHand(const Hand& hand, Hand *const){
+        return hand;
+    }
+    const Hand& toFullHand(const SimHand& hand, Hand *const pbuf){
+        hand.toHand(pbuf);
+        return *pbuf;
+    }
+    const Hand& stepsView(const Hand& hand){
+        return hand;
+    }
+    SimHandView stepsView(const SimHand& hand){
+        return hand.view();
+    }
+    
+    void storeDiffHandInfo(const SimHand& hand, DiffHandInfo *const pdi){
+        pdi->minimumSteps = hand.minimumSteps;
+        pdi->acceptable = hand.acceptable;
+        pdi->pieceHashKey = hand.pieceHashKey;
+    }
+    void restoreDiffHandInfo(SimHand *const phand, const DiffHandInfo& di){
+        phand->minimumSteps = di.minimumSteps;
+        phand->acceptable = di.acceptable;
+        phand->pieceHashKey = di.pieceHashKey;
     }
     
     /**************************行動による手牌の変化**************************/
     
     // 行動ごとの手牌の変化を毎回書くのがめんどいのでここでまとめてやる
+    // 行動後のシャンテン数と受け入れは NextHandInfo に入る
+    // 打牌の場合は手牌のシャンテン数と受け入れは元のままになっている
+    // 戻すときは DiffHandInfo に記録した値を戻すだけで再計算はしない
     
-    
-    void doTurnAction(Hand *const phand, const TurnAction& action,
+    template<class hand_t>
+    void doTurnAction(hand_t *const phand, const TurnAction& action,
                       DiffHandInfo *const pdhi, NextHandInfo *const pnhi){
         
         if(action.discard()){ // 打牌
-            phand->subAll(action.discarded());
-        }else if(action.drawKong()){ // 暗槓
+            subTempAll(phand, action.discarded(), pdhi, pnhi);
+            return;
+        }
+        storeDiffHandInfo(*phand, pdhi);
+        if(action.drawKong()){ // 暗槓
             phand->subGroupAll(action.piece(), N_KONG_PIECES, action.red());
             phand->addOpenedGroupNoPick(action.toKongMeld());
         }else{ // 小明槓
@@ -728,24 +1140,31 @@ namespace Mahjong{
             phand->subAll(ep);
             phand->expandOpenedGroup(ep);
         }
+        pnhi->minimumSteps = phand->minimumSteps;
+        pnhi->acceptable = phand->acceptable;
     }
-    void undoTurnAction(Hand *const phand, const TurnAction& action,
+    template<class hand_t>
+    void undoTurnAction(hand_t *const phand, const TurnAction& action,
                         const DiffHandInfo& dhi){
         
         if(action.discard()){ // 打牌
-            phand->addAll(action.discarded());
-        }else if(action.drawKong()){ // 暗槓
-            phand->addGroupAll(action.piece(), N_KONG_PIECES, action.red());
-            phand->subOpenedGroup(action.toKongMeld());
+            unsubAll(phand, dhi);
+            return;
+        }
+        if(action.drawKong()){ // 暗槓
+            phand->addGroup(action.piece(), N_KONG_PIECES, action.red());
+            phand->subOpenedGroupNoPick(action.toKongMeld());
         }else{ // 小明槓
             ExtPiece ep = action.extPiece();
-            phand->addAll(ep);
+            phand->add(ep);
             phand->reduceOpenedGroup(ep);
         }
+        restoreDiffHandInfo(phand, dhi);
     }
     void doResponseAction(Hand *const phand, const ResponseAction& action, ExtPiece picked,
                           DiffHandInfo *const pdhi, NextHandInfo *const pnhi){
         // チーとポンは打牌まで一気に行う
+        storeDiffHandInfo(*phand, pdhi);
         if(action.any()){ // パスでない
             if(action.chow()){ // チー
                 phand->subSeqExceptAll(action.piece(), toPiece(picked), action.red() && !isRed(picked));
@@ -759,23 +1178,26 @@ namespace Mahjong{
                 }
             }
         }
+        pnhi->minimumSteps = phand->minimumSteps;
+        pnhi->acceptable = phand->acceptable;
     }
     void undoResponseAction(Hand *const phand, const ResponseAction& action, ExtPiece picked,
                             const DiffHandInfo& dhi){
         // チーとポンは打牌まで一気に行う
         if(action.any()){ // パスでない
             if(action.chow()){ // チー
-                phand->addAll(action.discarded());
+                phand->add(action.discarded());
                 phand->subOpenedSeq(action);
-                phand->addSeqExceptAll(action.piece(), toPiece(picked), action.red() && !isRed(picked));
+                phand->addSeqExcept(action.piece(), toPiece(picked), action.red() && !isRed(picked));
             }else{ // ポン, 大明槓
                 if(action.pong()){ // ポン
-                    phand->addAll(action.discarded());
+                    phand->add(action.discarded());
                 }
                 phand->subOpenedGroup(action);
                 phand->addGroup(action.piece(), action.qty(), action.red() && !isRed(picked));
             }
         }
+        restoreDiffHandInfo(phand, dhi);
     }
     
     /**************************プレーヤー以外の牌の情報**************************/
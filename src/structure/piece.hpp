@@ -9,6 +9,7 @@
 #define MAHJONG_STRUCTURE_PIECE_HPP_
 
 #include "base.hpp"
+#include "tableFile.hpp"
 
 namespace Mahjong{
     
@@ -575,7 +576,7 @@ namespace Mahjong{
                                                          TYPE_MASK_NUMBERS_ALL,
                                                          TYPE_MASK_HONORS_ALL);
     
-    const bits256_t PIECE_SET_DOUBLE = NAIVE_MASK_ALL | PQR256_2; // 七対子
+    const bits256_t PQR256_DOUBLE = NAIVE_MASK_ALL & PQR256_2; // 七対子
     
     const bits256_t NAIVE_MASK_9T9P = bits256_t::packed64(TYPE_MASK_NUMBERS_EDGE,
                                                           TYPE_MASK_NUMBERS_EDGE,
@@ -1601,8 +1602,187 @@ namespace Mahjong{
     uint64_t *acceptableTable0;
     uint64_t *acceptableTable1;
     
-    uint32_t minimumStepsInfoTable[ipow(N_ONE_PIECE + 1, N_RANKS)];
-    uint64_t acceptableInfoTable[ipow(N_ONE_PIECE + 1, N_RANKS) * 2];
+    constexpr int N_STEPS_INFO_INDICES = ipow(N_ONE_PIECE + 1, N_RANKS);
+    
+    // minimumStepsInfoTable の1要素(steps)は 2ビットのパターン数 + 7ビット x パターン(頭1, 塔子3, 面子3)
+    constexpr int N_MAX_STEPS_PATTERNS = 3;
+    
+    struct StepsPattern{
+        int head, tarts, melds;
+        
+        // 面子+塔子が足りない状況での評価
+        int value()const noexcept{ return 2 * melds + tarts + head; }
+        // 他の種類の状況を gamma (= 4 - 他の面子数 - 他の塔子数 - 他の頭数) と頭の有無で表したときの評価
+        // 8 - (全種類の合計) がシャンテン数になる
+        int value(int gamma, int otherHead)const noexcept{
+            return min(value(), melds + gamma + ((head + otherHead > 0) ? 1 : 0));
+        }
+    };
+    
+    int decodeStepsInfo(uint32_t info, StepsPattern *const pat)noexcept{
+        const int n = info & 3;
+        info >>= 2;
+        for(int i = 0; i < n; ++i){
+            pat[i].head = info & 1;
+            pat[i].tarts = (info >> 1) & 7;
+            pat[i].melds = (info >> 4) & 7;
+            info >>= 7;
+        }
+        return n;
+    }
+    uint32_t encodeStepsInfo(const StepsPattern *const pat, int n)noexcept{
+        uint32_t info = n;
+        for(int i = 0; i < n; ++i){
+            info |= uint32_t(pat[i].head | (pat[i].tarts << 1) | (pat[i].melds << 4)) << (2 + 7 * i);
+        }
+        return info;
+    }
+    
+    uint32_t canonicalStepsInfo(uint32_t info)noexcept{
+        // パターンの順番をそろえた steps (同じパターン集合なら同じ値になる)
+        StepsPattern pat[N_MAX_STEPS_PATTERNS];
+        const int n = decodeStepsInfo(info, pat);
+        std::sort(pat, pat + n, [](const StepsPattern& a, const StepsPattern& b)->bool{
+            return encodeStepsInfo(&a, 1) < encodeStepsInfo(&b, 1);
+        });
+        return encodeStepsInfo(pat, n);
+    }
+    
+    // 1枚抜いた形の steps は辞書の番号で持つ(1ランク7ビット x 9ランク)
+    // 辞書は全添字の steps を正規化したものの昇順で、実際の種類は100に満たない
+    constexpr int STEPS_REMOVED_CODE_BITS = 7;
+    constexpr int N_STEPS_DICTIONARY = 1 << STEPS_REMOVED_CODE_BITS;
+    uint32_t stepsDictionary[N_STEPS_DICTIONARY];
+    
+    // シャンテン数計算用の情報を添字ごとに1つのレコードにまとめたもの
+    // 1種類あたりキャッシュライン1本で済むよう32バイト境界に揃える
+    // minimumStepsInfoTable, acceptableInfoTable はこれを作るための形式で、実行時には使わない
+    struct alignas(32) StepsInfoRecord{
+        uint64_t acceptable[2]; // acceptableInfoTable[index * 2 + flag]
+        uint64_t removed;       // ランク r を1枚抜いた形の steps の辞書番号(r * 7 ビット目から、無いランクは0)
+        uint32_t steps;         // minimumStepsInfoTable[index]
+        uint32_t ambiguous;     // 受け入れが複数パターンの和集合になっている組(flag * 7 + 組 のビット)
+        
+        uint32_t removedSteps(Rank r)const noexcept{
+            return stepsDictionary[(removed >> (r * STEPS_REMOVED_CODE_BITS)) & (N_STEPS_DICTIONARY - 1)];
+        }
+    };
+    static_assert(sizeof(StepsInfoRecord) == 32, "StepsInfoRecord must fit a half cache line.");
+    static_assert(STEPS_REMOVED_CODE_BITS * N_RANKS <= 64, "removed codes must fit in 64 bits.");
+    
+    // バイナリテーブルや共有メモリを mmap した場合はその領域を、それ以外は確保した領域を指す
+    const StepsInfoRecord *stepsInfoTable = nullptr;
+    
+    MappedTableFile stepsTableFile;
+    MappedTableFile stepsTableShared;
+    const char *const STEPS_TABLE_FILE_PATH = "./data/stepsTable.bin";
+    
+    // 自前で確保したテーブル領域(生成したもの、ヒュージページにコピーしたもの)
+    constexpr std::size_t STEPS_TABLES_SIZE = sizeof(StepsInfoRecord) * N_STEPS_INFO_INDICES;
+    void *stepsTablesMemory = nullptr;
+    TablePageType stepsTablesPageType = PAGE_NORMAL;
+    
+    void releasePrivateStepsTables(){
+        freeTableMemory(stepsTablesMemory, STEPS_TABLES_SIZE);
+        stepsTablesMemory = nullptr;
+        stepsTableFile.close();
+    }
+    void setStepsTablesMemory(void *const p, TablePageType type){
+        // 以前の領域は解放する
+        releasePrivateStepsTables();
+        stepsTableShared.close();
+        stepsTablesMemory = p;
+        stepsTablesPageType = type;
+        stepsInfoTable = static_cast<const StepsInfoRecord*>(p);
+    }
+    
+    int copyStepsTables(bool huge){
+        // 現在のテーブルを自前の領域にコピーして切り替える
+        TablePageType type;
+        void *const p = allocTableMemory(STEPS_TABLES_SIZE, huge, &type);
+        if(p == nullptr){
+            cerr << "failed to obtain memories of steps tables." << endl; return -1;
+        }
+        memcpy(p, stepsInfoTable, STEPS_TABLES_SIZE);
+        setStepsTablesMemory(p, type);
+        return 0;
+    }
+    
+    int packStepsTables(const uint32_t *const steps, const uint64_t *const acc,
+                        const uint32_t *const ambiguous = nullptr, bool huge = true){
+        // 別々の表からレコード形式を作って切り替える
+        // ambiguous が無い(外部の表から作る)場合は受け入れを和集合のまま使う
+        TablePageType type;
+        void *const p = allocTableMemory(STEPS_TABLES_SIZE, huge, &type);
+        if(p == nullptr){
+            cerr << "failed to obtain memories of steps tables." << endl; return -1;
+        }
+        StepsInfoRecord *const record = static_cast<StepsInfoRecord*>(p);
+        for(int i = 0; i < N_STEPS_INFO_INDICES; ++i){
+            record[i].acceptable[0] = acc[i * 2 + 0];
+            record[i].acceptable[1] = acc[i * 2 + 1];
+            record[i].steps = steps[i];
+            record[i].ambiguous = (ambiguous != nullptr) ? ambiguous[i] : 0;
+        }
+        // 辞書を作って1枚抜いた形の番号を埋める
+        std::vector<uint32_t> canonical(N_STEPS_INFO_INDICES);
+        for(int i = 0; i < N_STEPS_INFO_INDICES; ++i){
+            canonical[i] = canonicalStepsInfo(steps[i]);
+        }
+        std::vector<uint32_t> dictionary(canonical);
+        std::sort(dictionary.begin(), dictionary.end());
+        dictionary.erase(std::unique(dictionary.begin(), dictionary.end()), dictionary.end());
+        if(dictionary.size() > (std::size_t)N_STEPS_DICTIONARY){
+            freeTableMemory(p, STEPS_TABLES_SIZE);
+            cerr << "too many kinds of steps info (" << dictionary.size() << ")." << endl; return -1;
+        }
+        memset(stepsDictionary, 0, sizeof(stepsDictionary));
+        std::copy(dictionary.begin(), dictionary.end(), stepsDictionary);
+        for(int i = 0; i < N_STEPS_INFO_INDICES; ++i){
+            uint64_t removed = 0;
+            for(Rank r = RANK_MIN; r <= RANK_MAX; ++r){
+                if((i / ipow5Table[r]) % (N_ONE_PIECE + 1) == 0){ continue; }
+                const uint32_t c = canonical[i - ipow5Table[r]];
+                const uint64_t code = std::lower_bound(dictionary.begin(), dictionary.end(), c) - dictionary.begin();
+                removed |= code << (r * STEPS_REMOVED_CODE_BITS);
+            }
+            record[i].removed = removed;
+        }
+        setStepsTablesMemory(p, type);
+        return 0;
+    }
+    
+    // テーブルは別スレッドで準備するので、使う側は準備完了を待つ
+    std::atomic<bool> stepsTablesReady(false);
+    std::mutex stepsTablesMutex;
+    std::condition_variable stepsTablesCondition;
+    
+    void setStepsTablesReady(){
+        {
+            std::lock_guard<std::mutex> lock(stepsTablesMutex);
+            stepsTablesReady.store(true, std::memory_order_release);
+        }
+        stepsTablesCondition.notify_all();
+    }
+    void waitStepsTables(){
+        if(stepsTablesReady.load(std::memory_order_acquire)){ return; }
+        std::unique_lock<std::mutex> lock(stepsTablesMutex);
+        stepsTablesCondition.wait(lock, []()->bool{ return stepsTablesReady.load(std::memory_order_acquire); });
+    }
+    
+    constexpr int SHANTEN_TABLE_KEY_BITS = 3; // 水上さんのテーブルのキーは1ランク3ビット
+    
+    int toMizukamiIndex(uint32_t key){
+        // 3ビット x 9 のキーを5進数(1が最上位)の添字に変換
+        // 5枚以上の場合は -1
+        int index = 0;
+        for(int i = N_RANKS - 1; i >= 0; --i){
+            int n = (key >> (SHANTEN_TABLE_KEY_BITS * i)) & ((1 << SHANTEN_TABLE_KEY_BITS) - 1);
+            if(n > N_ONE_PIECE){ return -1; }
+            index = index * (N_ONE_PIECE + 1) + n;
+        }
+        return index;
+    }
     
     int initShantenTable(){
         std::ifstream ifs("./data/shanten_table.txt");
@@ -1610,16 +1790,20 @@ namespace Mahjong{
             cerr << "failed to open Shanten Table." << endl; return -1;
         }
         
-        shantenTable = (uint32_t*)malloc(sizeof(uint32_t) * 0x07ffffff);
+        // 意味のあるキーは5^9個なので密な5進数添字で持つ
+        shantenTable = (uint32_t*)malloc(sizeof(uint32_t) * ipow(5, N_RANKS));
         if(shantenTable == nullptr){
             cerr << "failed to obtain memories of Shanten Table." << endl; return -1;
         }
-        memset(shantenTable, 0, sizeof(uint32_t) * 0x07ffffff);
+        memset(shantenTable, 0, sizeof(uint32_t) * ipow(5, N_RANKS));
         const char delim = ' ';
         std::string str;
         while(std::getline(ifs, str)){
             auto result = split(str, delim);
-            shantenTable[atoi(result[0].c_str())] = atoi(result[1].c_str());
+            int index = toMizukamiIndex(atoi(result[0].c_str()));
+            if(index >= 0){
+                shantenTable[index] = atoi(result[1].c_str());
+            }
         }
         
         return 0;
@@ -1654,41 +1838,317 @@ namespace Mahjong{
         return 0;
     }
     
-    int initMinimumStepsInfoTable(){
+    int initMinimumStepsInfoTable(uint32_t *const table){
         std::ifstream ifs("./data/minimumStepsInfoTable.dat");
         if(!ifs){
             cerr << "failed to open minimumStepsInfoTable.dat!" << endl;
             return -1;
         }
-        memset(minimumStepsInfoTable, 0, sizeof(minimumStepsInfoTable));
-        uint32_t mmax = 0;
+        memset(table, 0, sizeof(uint32_t) * N_STEPS_INFO_INDICES);
         std::string str;
         int cnt = 0;
-        while(std::getline(ifs, str)){
-            minimumStepsInfoTable[cnt] = atoi(str.c_str());
+        while(cnt < N_STEPS_INFO_INDICES && std::getline(ifs, str)){
+            table[cnt] = atoi(str.c_str());
             cnt += 1;
-            mmax = max(mmax, minimumStepsInfoTable[cnt - 1] & 3);
         }
-        cerr << mmax << endl;
         return 0;
     }
     
-    int initAcceptableInfoTable(){
+    int initAcceptableInfoTable(uint64_t *const table){
         std::ifstream ifs("./data/acceptableInfoTable.dat");
         if(!ifs){
             cerr << "failed to open acceptableInfoTable.dat!" << endl;
             return -1;
         }
-        memset(acceptableInfoTable, 0, sizeof(acceptableInfoTable));
+        memset(table, 0, sizeof(uint64_t) * N_STEPS_INFO_INDICES * 2);
         std::string str;
         int cnt = 0;
-        while(std::getline(ifs, str)){
-            acceptableInfoTable[cnt] = atoll(str.c_str());
+        while(cnt < N_STEPS_INFO_INDICES * 2 && std::getline(ifs, str)){
+            table[cnt] = atoll(str.c_str());
             cnt += 1;
         }
         return 0;
     }
     
+    int loadStepsTextTables(){
+        // テキストの2つの表を読んでレコード形式にする
+        std::vector<uint32_t> steps(N_STEPS_INFO_INDICES);
+        std::vector<uint64_t> acc(N_STEPS_INFO_INDICES * 2);
+        if(initMinimumStepsInfoTable(steps.data()) < 0){ return -1; }
+        if(initAcceptableInfoTable(acc.data()) < 0){ return -1; }
+        return packStepsTables(steps.data(), acc.data());
+    }
+    
+    int useMappedStepsTables(MappedTableFile& file, const std::string& name){
+        const StepsInfoRecord *const record = file.section<StepsInfoRecord>(SECTION_STEPS_INFO_RECORD, N_STEPS_INFO_INDICES);
+        const uint32_t *const dictionary = file.section<uint32_t>(SECTION_STEPS_DICTIONARY, N_STEPS_DICTIONARY);
+        if(record == nullptr || dictionary == nullptr){
+            cerr << "lack of sections in " << name << "." << endl;
+            file.close();
+            return -1;
+        }
+        memcpy(stepsDictionary, dictionary, sizeof(stepsDictionary));
+        stepsInfoTable = record;
+        return 0;
+    }
+    
+    int loadStepsTableFile(const std::string& path){
+        // バイナリテーブルを読み込み専用で mmap する
+        if(stepsTableFile.open(path) < 0){ return -1; }
+        return useMappedStepsTables(stepsTableFile, path);
+    }
+    
+    std::vector<TableSectionSource> stepsTableSources(){
+        return {
+            {SECTION_STEPS_INFO_RECORD, sizeof(StepsInfoRecord), (uint64_t)N_STEPS_INFO_INDICES, stepsInfoTable},
+            {SECTION_STEPS_DICTIONARY, sizeof(uint32_t), (uint64_t)N_STEPS_DICTIONARY, stepsDictionary},
+        };
+    }
+    
+    int saveStepsTableFile(const std::string& path){
+        // 現在のテーブルをバイナリ形式で保存
+        if(stepsInfoTable == nullptr){
+            cerr << "tables are not ready." << endl; return -1;
+        }
+        return writeTableFile(path, stepsTableSources());
+    }
+    
+    /**************************テーブル共有**************************/
+    
+    // 環境変数 MAHJONG_TABLE_SHM に共有メモリ名(例: /akinasu_tables)を指定すると、
+    // 最初のプロセスがテーブルを共有メモリに置き、以降のプロセスはそれに attach する
+    // 作成中のものは書き終わるまで待つ
+    // 作成したプロセスが途中で落ちたものや古い形式のものが残っている場合は消して作り直す
+    
+    const char *const STEPS_TABLE_SHM_ENV = "MAHJONG_TABLE_SHM";
+    
+    int attachSharedStepsTables(const std::string& name){
+        // 古いものを消した場合は SHARED_TABLE_REMOVED
+        const int ret = stepsTableShared.openShared(name);
+        if(ret < 0){ return ret; }
+        return useMappedStepsTables(stepsTableShared, name);
+    }
+    
+    int publishSharedStepsTables(const std::string& name){
+        // 作成に成功するか、既に有効なものがあれば attach して 0
+        for(int trial = 0; trial < 3; ++trial){
+            if(publishSharedTable(name, stepsTableSources()) == 0){
+                return attachSharedStepsTables(name);
+            }
+            if(errno != EEXIST){ break; }
+            // 他のプロセスが先に作った (作成中なら ready になるまで待つ)
+            const int ret = attachSharedStepsTables(name);
+            if(ret == 0){ return 0; }
+            if(ret != SHARED_TABLE_REMOVED){ break; }
+            // 古いものだったので消した(か他のプロセスが消した)ので作り直す
+        }
+        cerr << "failed to publish shared tables " << name << "." << endl;
+        return -1;
+    }
+    
+    /**************************テーブル生成**************************/
+    
+    // minimumStepsInfoTable, acceptableInfoTable の形式の表を外部データなしで計算する
+    // 1種類の数牌ごとに (頭, 塔子, 面子) の組のうち他の種類の状況次第で最適になりうるもの(高々3つ)を列挙し、
+    // 受け入れは他の種類を含めた面子+塔子数と他の種類の頭の有無で場合分けして求める
+    // 13枚以下の形のみ計算するので、枚数の少ない形から順に並列に処理すればよい
+    
+    constexpr int N_MAX_SUIT_PIECES = N_DEALT_PIECES + 1; // 1種類に入りうる最大枚数
+    
+    bool dominatesStepsPattern(const StepsPattern& a, const StepsPattern& b)noexcept{
+        // 他の種類の状況によらず a の評価が b 以上か
+        if(a.head >= b.head){
+            return a.melds >= b.melds && a.value() >= b.value();
+        }else{
+            // 頭が無い方は他の種類にも頭が無い場合に1損をする
+            return a.melds > b.melds && a.value() >= b.value();
+        }
+    }
+    
+    void addStepsPattern(StepsPattern *const pat, int *const pn, const StepsPattern& p){
+        if(p.head > 1){ return; }
+        for(int i = 0; i < *pn; ++i){
+            if(dominatesStepsPattern(pat[i], p)){ return; }
+        }
+        int n = 0;
+        for(int i = 0; i < *pn; ++i){
+            if(!dominatesStepsPattern(p, pat[i])){
+                pat[n++] = pat[i];
+            }
+        }
+        ASSERT(n < N_MAX_STEPS_PATTERNS, cerr << n << endl;);
+        pat[n++] = p;
+        *pn = n;
+    }
+    
+    int rankCountMin(int index, int r)noexcept{
+        return (index / ipow5Table[r]) % (N_ONE_PIECE + 1);
+    }
+    
+    uint32_t genMinimumStepsInfo(const uint32_t *const table, int index){
+        // 一番小さいランクの牌の使い方で場合分けし、残りは計算済みの表を引く
+        StepsPattern pat[N_MAX_STEPS_PATTERNS];
+        int n = 0;
+        if(index == 0){
+            pat[n++] = {0, 0, 0};
+            return encodeStepsInfo(pat, n);
+        }
+        int r = 0;
+        while(rankCountMin(index, r) == 0){ ++r; }
+        const int c0 = rankCountMin(index, r);
+        const int c1 = (r + 1 < N_RANKS) ? rankCountMin(index, r + 1) : 0;
+        const int c2 = (r + 2 < N_RANKS) ? rankCountMin(index, r + 2) : 0;
+        auto from = [&](int removed, int head, int tarts, int melds)->void{
+            StepsPattern rest[N_MAX_STEPS_PATTERNS];
+            const int rn = decodeStepsInfo(table[index - removed], rest);
+            for(int i = 0; i < rn; ++i){
+                addStepsPattern(pat, &n, {rest[i].head + head, rest[i].tarts + tarts, rest[i].melds + melds});
+            }
+        };
+        from(ipow5Table[r], 0, 0, 0); // 孤立
+        if(c0 >= 2){
+            from(ipow5Table[r] * 2, 0, 1, 0); // 対子を塔子に
+            from(ipow5Table[r] * 2, 1, 0, 0); // 対子を頭に
+        }
+        if(c0 >= 3){ from(ipow5Table[r] * 3, 0, 0, 1); } // 刻子
+        if(c1 > 0 && c2 > 0){ from(ipow5Table[r] + ipow5Table[r + 1] + ipow5Table[r + 2], 0, 0, 1); } // 順子
+        if(c1 > 0){ from(ipow5Table[r] + ipow5Table[r + 1], 0, 1, 0); } // 両面、辺張
+        if(c2 > 0){ from(ipow5Table[r] + ipow5Table[r + 2], 0, 1, 0); } // 嵌張
+        return encodeStepsInfo(pat, n);
+    }
+    
+    struct AcceptableUnion{
+        // 複数のパターンの受け入れの和集合
+        // 受け入れの異なるパターンをまとめた場合、実際の手牌では余計なランクが混ざりうる
+        uint32_t bits = 0;
+        int patterns = 0;
+        bool ambiguous = false;
+        
+        void add(uint32_t b)noexcept{
+            if(patterns > 0 && b != bits){ ambiguous = true; }
+            bits |= b;
+            patterns += 1;
+        }
+    };
+    
+    void genAcceptableBits(const uint32_t *const table, int index, int head, int sigma, int otherHead,
+                           AcceptableUnion *const pu){
+        // この種類の頭の有無 head、4 - (全体の面子+塔子数) = sigma、他の頭の有無 otherHead のとき
+        // シャンテン数を減らすランクの集合
+        // 頭の有無が同じで sigma と矛盾しない最適パターンが複数ある場合は和集合とする
+        StepsPattern pat[N_MAX_STEPS_PATTERNS], next[N_MAX_STEPS_PATTERNS];
+        const int n = decodeStepsInfo(table[index], pat);
+        for(int i = 0; i < n; ++i){
+            if(pat[i].head != head){ continue; }
+            const int gamma = sigma + pat[i].melds + pat[i].tarts + pat[i].head - ((head + otherHead > 0) ? 1 : 0);
+            const int value = pat[i].value(gamma, otherHead);
+            bool best = true;
+            for(int j = 0; j < n; ++j){
+                if(pat[j].value(gamma, otherHead) > value){ best = false; break; }
+            }
+            if(!best){ continue; }
+            uint32_t bits = 0;
+            for(int r = 0; r < N_RANKS; ++r){
+                if(rankCountMin(index, r) >= N_ONE_PIECE){ continue; }
+                const int nn = decodeStepsInfo(table[index + ipow5Table[r]], next);
+                for(int j = 0; j < nn; ++j){
+                    if(next[j].value(gamma, otherHead) > value){
+                        bits |= 1U << r;
+                        break;
+                    }
+                }
+            }
+            pu->add(bits);
+        }
+    }
+    
+    uint64_t genAcceptableInfo(const uint32_t *const table, int index, int flag, uint32_t *const pambiguous){
+        // 9ビット x 7組
+        // 組 2k + e ... k = 0:面子+塔子が5以上, 1:4, 2:3 / e = 他の種類に頭が無い
+        // 組 6 ... 面子+塔子が3未満(頭の有無によらない)
+        // 和集合が過大になりうる組は *pambiguous の flag * 7 + 組 のビットを立てる
+        const int head = 1 - flag;
+        uint64_t info = 0;
+        for(int k = 0; k < 3; ++k){
+            for(int e = 0; e < 2; ++e){
+                AcceptableUnion u;
+                genAcceptableBits(table, index, head, k - 1, 1 - e, &u);
+                info |= uint64_t(u.bits) << (N_RANKS * (2 * k + e));
+                if(u.ambiguous){ *pambiguous |= 1U << (flag * 7 + 2 * k + e); }
+            }
+        }
+        AcceptableUnion u;
+        for(int h = 0; h <= 1; ++h){
+            for(int oh = 0; oh <= 1; ++oh){
+                genAcceptableBits(table, index, h, 2, oh, &u);
+            }
+        }
+        info |= uint64_t(u.bits) << (N_RANKS * 6);
+        if(u.ambiguous){ *pambiguous |= 1U << (flag * 7 + 6); }
+        return info;
+    }
+    
+    int generateStepsTables(){
+        std::vector<uint32_t> stepsVector(N_STEPS_INFO_INDICES, 0);
+        std::vector<uint64_t> accVector(N_STEPS_INFO_INDICES * 2, 0);
+        std::vector<uint32_t> ambiguousVector(N_STEPS_INFO_INDICES, 0);
+        uint32_t *const steps = stepsVector.data();
+        uint64_t *const acc = accVector.data();
+        uint32_t *const ambiguous = ambiguousVector.data();
+        
+        // 枚数ごとに添字を分ける
+        std::array<std::vector<int>, N_MAX_SUIT_PIECES + 1> level;
+        for(int i = 0; i < N_STEPS_INFO_INDICES; ++i){
+            int sum = 0;
+            for(int r = 0; r < N_RANKS; ++r){ sum += rankCountMin(i, r); }
+            if(sum <= N_MAX_SUIT_PIECES){ level[sum].push_back(i); }
+        }
+        // 同じ枚数の形は互いに依存しない
+        for(int sum = 0; sum <= N_MAX_SUIT_PIECES; ++sum){
+            const std::vector<int>& v = level[sum];
+#pragma omp parallel for schedule(dynamic, 1024)
+            for(int i = 0; i < (int)v.size(); ++i){
+                steps[v[i]] = genMinimumStepsInfo(steps, v[i]);
+            }
+        }
+        // 受け入れは1枚足した形まで必要
+        for(int sum = 0; sum < N_MAX_SUIT_PIECES; ++sum){
+            const std::vector<int>& v = level[sum];
+#pragma omp parallel for schedule(dynamic, 1024)
+            for(int i = 0; i < (int)v.size(); ++i){
+                acc[v[i] * 2 + 0] = genAcceptableInfo(steps, v[i], 0, &ambiguous[v[i]]);
+                acc[v[i] * 2 + 1] = genAcceptableInfo(steps, v[i], 1, &ambiguous[v[i]]);
+            }
+        }
+        return packStepsTables(steps, acc, ambiguous);
+    }
+    
+    int initStepsTables(){
+        // 共有メモリ指定があればまず attach を試みる
+        const char *const shmName = getenv(STEPS_TABLE_SHM_ENV);
+        if(shmName != nullptr && attachSharedStepsTables(shmName) == 0){ return 0; }
+        
+        // バイナリがあればそれを使い、無ければその場で計算する
+        if(loadStepsTableFile(STEPS_TABLE_FILE_PATH) < 0){
+            cerr << "generate steps tables." << endl;
+            if(generateStepsTables() < 0){ return -1; }
+        }
+        if(shmName != nullptr){
+            const StepsInfoRecord *const record = stepsInfoTable;
+            if(publishSharedStepsTables(shmName) == 0){
+                // 共有側に切り替えたので自前の領域は不要
+                releasePrivateStepsTables();
+                return 0;
+            }
+            stepsInfoTable = record;
+        }
+        // 共有しない場合はヒュージページに置く
+        if(stepsTablesMemory == nullptr){
+            copyStepsTables(true);
+        }
+        return 0;
+    }
+    
     template<class hand_t>
     int calcAcceptableBits(const hand_t& hand, int fu_ro, BitSet64 *const pac){
         
@@ -1703,15 +2163,15 @@ namespace Mahjong{
         
         // 数牌
         for(PieceType pt = PIECE_TYPE_NUMBERS_MIN; pt <= PIECE_TYPE_NUMBERS_MAX; ++pt){
-            // jに数牌の3x9ビットの情報を押し込む
+            // jに数牌の5進数9桁の情報を押し込む(1が最上位)
             int j = hand[pt][RANK_MIN];
             //ASSERT((unsigned)j <= N_ONE_PIECE, cerr << j << endl;);
             for(Rank r = RANK_MIN + 1; r <= RANK_MAX; ++r){
-                j <<= 3;
-                j |= hand[pt][r];
+                j *= 5;
+                j += hand[pt][r];
                 //ASSERT((unsigned)hand[pt][r] <= N_ONE_PIECE, cerr << j << endl;);
             }
-            DERR << BitArray32<3, 9>(j) << endl;
+            DERR << j << endl;
             
             uint32_t kv = shantenTable[j]; // テーブルを引く
             m[pt] = (kv & 0x00000003);
@@ -1871,7 +2331,57 @@ namespace Mahjong{
     }
     
     template<class hand_t>
-    int calcMinimumSteps(const hand_t& hand, PieceExistance *const pac){
+    void prefetchStepsInfo(const hand_t& hand, const StepsInfoRecord **const records){
+        // 数牌3種類のレコードの位置を先に求めてまとめてプリフェッチする
+        // レコードは32バイト境界なので1種類あたりキャッシュライン1本
+        for(PieceType pt = PIECE_TYPE_NUMBERS_MIN; pt <= PIECE_TYPE_NUMBERS_MAX; ++pt){
+            records[pt] = stepsInfoTable + hand.pieceMin[pt].data();
+            __builtin_prefetch(records[pt], 0, 3);
+        }
+    }
+    
+    int combineMinimumSteps(const uint32_t *const info, int h2, int melds)noexcept{
+        // 各種類の steps 情報と字牌の対子数 h2、字牌の刻子と副露の数 melds からシャンテン数を組み合わせる
+        // 受け入れの確認用の素直な計算
+        StepsPattern pat[N_NUMBER_PIECE_TYPES][N_MAX_STEPS_PATTERNS];
+        int n[N_NUMBER_PIECE_TYPES];
+        for(PieceType pt = PIECE_TYPE_NUMBERS_MIN; pt <= PIECE_TYPE_NUMBERS_MAX; ++pt){
+            n[pt] = decodeStepsInfo(info[pt], pat[pt]);
+        }
+        int steps = N_DEALT_PIECES + 1;
+        for(int k = 0; k < n[0]; ++k){
+            for(int kk = 0; kk < n[1]; ++kk){
+                for(int kkk = 0; kkk < n[2]; ++kkk){
+                    const StepsPattern& a = pat[0][k], b = pat[1][kk], c = pat[2][kkk];
+                    const int heads = a.head + b.head + c.head + h2;
+                    const int headEx = (heads >= 1) ? 1 : 0;
+                    const int m = a.melds + b.melds + c.melds + melds;
+                    const int t = a.tarts + b.tarts + c.tarts + heads - headEx;
+                    steps = min(steps, 8 - 2 * m - min(t, 4 - m) - headEx);
+                }
+            }
+        }
+        return steps;
+    }
+    
+    uint32_t confirmAcceptableRanks(const uint32_t *const info, const StepsInfoRecord *const record, PieceType pt,
+                                    uint32_t ranks, int h2, int melds, int steps)noexcept{
+        // 和集合が過大になりうる組から得た種類 pt の受け入れランクを、1枚足した形で組み合わせ直して確かめる
+        uint32_t next[N_NUMBER_PIECE_TYPES] = {info[0], info[1], info[2]};
+        uint32_t bits = 0;
+        for(; ranks; ranks &= ranks - 1){
+            const int r = bsf(ranks);
+            next[pt] = record[ipow5Table[r]].steps;
+            if(combineMinimumSteps(next, h2, melds) < steps){ bits |= 1U << r; }
+        }
+        return bits;
+    }
+    
+    template<class hand_t>
+    int calcNormalMinimumStepsLoop(const hand_t& hand, const uint32_t *const info,
+                                   const StepsInfoRecord *const *const records, PieceExistance *const pac){
+        // 4面子1雀頭形のシャンテン数と受け入れ牌(レコード位置と steps は読み込み済み)
+        // 組み合わせを分岐しながら全探索する版(比較用)
         const uint64_t honorPqr = hand.pqr[HONOR]; // 字牌のPQR
         const int opened = hand.openedMelds(); // 副露数
         const int h3 = countBits64(honorPqr & PQR_34); // 字牌が3つ以上揃っている個数
@@ -1883,7 +2393,7 @@ namespace Mahjong{
         
         // 数牌
         for(PieceType pt = PIECE_TYPE_NUMBERS_MIN; pt <= PIECE_TYPE_NUMBERS_MAX; ++pt){
-            uint32_t kv = minimumStepsInfoTable[hand.pieceMin[pt].data()]; // テーブルを引く
+            uint32_t kv = info[pt];
             m[pt] = kv & 3; // 0 ~ 3
             //DERR << "kv = " << kv << " m = " << m[pt] << endl;
             
@@ -1984,8 +2494,12 @@ namespace Mahjong{
                 else if(pro[pat] > 4 && head == 0){ shift = 9; }
                 //else if(pro[pat] > 4 && head > 0){ shift = 0; }*/
                 
-                uint64_t accdata = acceptableInfoTable[hand.pieceMin[pt].data() * 2 + flag];
-                pac->operator |=(((accdata >> shift) & ((1 << N_RANKS) - 1)) << toPiece(pt, RANK_MIN));
+                uint64_t accdata = records[pt]->acceptable[flag];
+                uint32_t ranks = (accdata >> shift) & ((1 << N_RANKS) - 1);
+                if((records[pt]->ambiguous >> (flag * 7 + shift / N_RANKS)) & 1){
+                    ranks = confirmAcceptableRanks(info, records[pt], pt, ranks, h2, h3 + opened, steps);
+                }
+                pac->operator |=(uint64_t(ranks) << toPiece(pt, RANK_MIN));
             }
             // 特別な場合
             if(pro[pat] < 4 || headAll == 0){ // 1枚以上2枚以下の字牌がOK
@@ -1997,18 +2511,611 @@ namespace Mahjong{
         return steps;
     }
     
+    // パターンの組み合わせ用の表
+    // STEPS_PATTERN_WIDE: 7ビットのパターン(頭1, 塔子3, 面子3)を 頭 | 塔子 << 8 | 面子 << 16 に広げたもの(足し算用)
+    // value[面子数][塔子数 + 頭数][頭の有無]: (シャンテン数 + 1) | (頭を除いた面子+塔子数(5で頭打ち) << 4)
+    constexpr int N_COMBINATION_MELDS = 5;
+    constexpr int N_COMBINATION_TARTS = 32;
+    constexpr int N_COMBINATION_STEPS = 10; // シャンテン数 + 1 は 0 ~ 9
+    constexpr int N_COMBINATION_MT = 6; // 面子+塔子数は 5 以上を区別しない
+    
+    struct StepsCombinationTable{
+        uint32_t wide[1 << 7];
+        uint8_t value[N_COMBINATION_MELDS][N_COMBINATION_TARTS][2];
+        
+        constexpr StepsCombinationTable():wide(), value(){
+            for(int p = 0; p < (1 << 7); ++p){
+                wide[p] = (p & 1) | (((p >> 1) & 7) << 8) | (((p >> 4) & 7) << 16);
+            }
+            for(int m = 0; m < N_COMBINATION_MELDS; ++m){
+                for(int t = 0; t < N_COMBINATION_TARTS; ++t){
+                    for(int h = 0; h < 2; ++h){
+                        const int tarts = (t - h > 0) ? (t - h) : 0; // 頭1つは塔子に数えない
+                        const int used = (tarts < 4 - m) ? tarts : (4 - m); // 面子+塔子は4つまで
+                        const int mt = (m + tarts < N_COMBINATION_MT - 1) ? (m + tarts) : (N_COMBINATION_MT - 1);
+                        value[m][t][h] = uint8_t((8 - 2 * m - used - h + 1) | (mt << 4));
+                    }
+                }
+            }
+        }
+    };
+    constexpr StepsCombinationTable STEPS_COMBINATION_TABLE;
+    
+    template<class hand_t>
+    int calcNormalMinimumSteps(const hand_t& hand, const uint32_t *const info,
+                               const StepsInfoRecord *const *const records, PieceExistance *const pac){
+        // 4面子1雀頭形のシャンテン数と受け入れ牌(レコード位置と steps は読み込み済み)
+        // 各種類のパターンを広げた値の和から表を引くので、組み合わせの探索に分岐が無い
+        // 最小を与える組み合わせは (面子+塔子数, 各種類の頭の有無) の 6 x 8 通りのビットで重複を除く
+        const uint64_t honorPqr = hand.pqr[HONOR]; // 字牌のPQR
+        const int opened = hand.openedMelds(); // 副露数
+        const int h3 = countBits64(honorPqr & PQR_34); // 字牌が3つ以上揃っている個数
+        const int h2 = countBits64(honorPqr & PQR_2); // 字牌がちょうど2つ揃っている個数
+        const uint32_t honorWide = h2 | ((h3 + opened) << 16);
+        
+        uint32_t wide[N_NUMBER_PIECE_TYPES][N_MAX_STEPS_PATTERNS];
+        int headKey[N_NUMBER_PIECE_TYPES][N_MAX_STEPS_PATTERNS];
+        int m[N_NUMBER_PIECE_TYPES];
+        for(PieceType pt = PIECE_TYPE_NUMBERS_MIN; pt <= PIECE_TYPE_NUMBERS_MAX; ++pt){
+            const uint32_t kv = info[pt];
+            m[pt] = kv & 3;
+            for(int i = 0; i < m[pt]; ++i){
+                wide[pt][i] = STEPS_COMBINATION_TABLE.wide[(kv >> (2 + 7 * i)) & 127];
+                headKey[pt][i] = (wide[pt][i] & 1) << pt;
+            }
+        }
+        
+        uint64_t found[N_COMBINATION_STEPS] = {0};
+        int best = N_COMBINATION_STEPS - 1;
+        for(int k = 0; k < m[0]; ++k){
+            for(int kk = 0; kk < m[1]; ++kk){
+                const uint32_t w01 = wide[0][k] + wide[1][kk] + honorWide;
+                const int hk01 = headKey[0][k] | headKey[1][kk];
+                for(int kkk = 0; kkk < m[2]; ++kkk){
+                    const uint32_t w = w01 + wide[2][kkk];
+                    const int heads = w & 255;
+                    const int tarts = min(int((w >> 8) & 255) + heads, N_COMBINATION_TARTS - 1);
+                    const int melds = min(int(w >> 16), N_COMBINATION_MELDS - 1);
+                    const int v = STEPS_COMBINATION_TABLE.value[melds][tarts][heads > 0];
+                    const int s = v & 15;
+                    found[s] |= 1ULL << (((v >> 4) << 3) | hk01 | headKey[2][kkk]);
+                    best = min(best, s);
+                }
+            }
+        }
+        
+        pac->reset();
+        for(uint64_t keys = found[best]; keys; keys &= keys - 1){
+            const int key = bsf(keys);
+            const int mt = key >> 3;
+            const int headAll = countBits64(key & 7) + h2;
+            
+            for(PieceType pt = PIECE_TYPE_NUMBERS_MIN; pt <= PIECE_TYPE_NUMBERS_MAX; ++pt){
+                const int myHead = (key >> pt) & 1;
+                const int head = headAll - myHead;
+                int flag, shift;
+                if(mt < 3){
+                    flag = 0;
+                    shift = 54;
+                }else{
+                    flag = 1 - myHead;
+                    shift = 9 * ((max(0, 5 - mt)) * 2 + ((head == 0) ? 1 : 0));
+                }
+                uint64_t accdata = records[pt]->acceptable[flag];
+                uint32_t ranks = (accdata >> shift) & ((1 << N_RANKS) - 1);
+                if((records[pt]->ambiguous >> (flag * 7 + shift / N_RANKS)) & 1){
+                    ranks = confirmAcceptableRanks(info, records[pt], pt, ranks, h2, h3 + opened, best - 1);
+                }
+                pac->operator |=(uint64_t(ranks) << toPiece(pt, RANK_MIN));
+            }
+            // 特別な場合
+            if(mt < 4 || headAll == 0){ // 1枚以上2枚以下の字牌がOK
+                pac->operator |=(pext(honorPqr | (honorPqr << 1), PQR_2) << toPiece(HONOR, RANK_MIN));
+            }else if(!((headAll == 1) && h2 == 1)){ // ちょうど2枚の字牌がOK
+                pac->operator |=(pext(honorPqr & PQR_2, PQR_2) << toPiece(HONOR, RANK_MIN));
+            }
+        }
+        return best - 1;
+    }
+    
+    template<class hand_t>
+    int calcNormalMinimumStepsLoop(const hand_t& hand, PieceExistance *const pac){
+        if(!stepsTablesReady.load(std::memory_order_acquire)){ waitStepsTables(); }
+        const StepsInfoRecord *records[N_NUMBER_PIECE_TYPES];
+        prefetchStepsInfo(hand, records);
+        const uint32_t info[N_NUMBER_PIECE_TYPES] = {records[0]->steps, records[1]->steps, records[2]->steps};
+        return calcNormalMinimumStepsLoop(hand, info, records, pac);
+    }
+    
+    template<class hand_t>
+    int calcNormalMinimumSteps(const hand_t& hand, const StepsInfoRecord *const *const records, PieceExistance *const pac){
+        const uint32_t info[N_NUMBER_PIECE_TYPES] = {records[0]->steps, records[1]->steps, records[2]->steps}; // テーブルを引く
+        return calcNormalMinimumSteps(hand, info, records, pac);
+    }
+    
+    template<class hand_t>
+    int calcNormalMinimumSteps(const hand_t& hand, PieceExistance *const pac){
+        // 4面子1雀頭形のシャンテン数と受け入れ牌
+        if(!stepsTablesReady.load(std::memory_order_acquire)){ waitStepsTables(); }
+        const StepsInfoRecord *records[N_NUMBER_PIECE_TYPES];
+        prefetchStepsInfo(hand, records);
+        return calcNormalMinimumSteps(hand, records, pac);
+    }
+    
+    // 七対子と国士無双の判定用のマスク(scの1枚目の位置)
+    constexpr uint64_t TYPE_SC1_NUMBERS_ALL    = TYPE_MASK_NUMBERS_ALL & PQR_1;
+    constexpr uint64_t TYPE_SC1_HONORS_ALL     = TYPE_MASK_HONORS_ALL & PQR_1;
+    constexpr uint64_t TYPE_SC1_NUMBERS_ORPHAN = TYPE_MASK_NUMBERS_EDGE & PQR_1;
+    constexpr uint64_t TYPE_SC1_HONORS_ORPHAN  = TYPE_SC1_HONORS_ALL;
+    
+    template<class hand_t>
+    int calcSevenPairsMinimumSteps(const hand_t& hand, PieceExistance *const pac){
+        // 七対子形のシャンテン数と受け入れ牌
+        // pqrは各牌1ビットなので種類数と対子数はビット数えで出る(4枚は1対子扱い)
+        int kinds = 0, pairs = 0;
+        for(PieceType pt = PIECE_TYPE_MIN; pt <= PIECE_TYPE_MAX; ++pt){
+            kinds += countBits64(hand.pqr[pt]);
+            pairs += countBits64(hand.pqr[pt] & PQR_234);
+        }
+        const int lack = max(0, (N_DEALT_PIECES + 1) / 2 - kinds); // 足りない種類数(7種類必要)
+        // 1枚の牌は対子になるので常に受け入れ、種類が足りなければ持っていない牌も受け入れ
+        pac->reset();
+        for(PieceType pt = PIECE_TYPE_MIN; pt <= PIECE_TYPE_MAX; ++pt){
+            uint64_t acc = hand.pqr[pt] & PQR_1;
+            if(lack > 0){
+                acc |= ~hand.sc[pt] & (pt == HONOR ? TYPE_SC1_HONORS_ALL : TYPE_SC1_NUMBERS_ALL);
+            }
+            pac->operator |=(pext(acc, PQR_1) << toPiece(pt, RANK_MIN));
+        }
+        return (N_DEALT_PIECES + 1) / 2 - 1 - pairs + lack;
+    }
+    
+    template<class hand_t>
+    int calcThirteenOrphansMinimumSteps(const hand_t& hand, PieceExistance *const pac){
+        // 国士無双形のシャンテン数と受け入れ牌
+        int kinds = 0;
+        bool pair = false;
+        for(PieceType pt = PIECE_TYPE_MIN; pt <= PIECE_TYPE_MAX; ++pt){
+            const uint64_t mask = (pt == HONOR) ? TYPE_SC1_HONORS_ORPHAN : TYPE_SC1_NUMBERS_ORPHAN;
+            kinds += countBits64(hand.sc[pt] & mask);
+            pair |= (hand.sc[pt] & (mask << 1)) != 0;
+        }
+        // 持っていない么九牌は常に受け入れ、対子が無ければ持っている么九牌も受け入れ
+        pac->reset();
+        for(PieceType pt = PIECE_TYPE_MIN; pt <= PIECE_TYPE_MAX; ++pt){
+            const uint64_t mask = (pt == HONOR) ? TYPE_SC1_HONORS_ORPHAN : TYPE_SC1_NUMBERS_ORPHAN;
+            const uint64_t acc = pair ? (~hand.sc[pt] & mask) : mask;
+            pac->operator |=(pext(acc, PQR_1) << toPiece(pt, RANK_MIN));
+        }
+        return N_DEALT_PIECES - kinds - (pair ? 1 : 0);
+    }
+    
+    template<class hand_t>
+    int calcMinimumSteps(const hand_t& hand, const uint32_t *const info,
+                         const StepsInfoRecord *const *const records, PieceExistance *const pac){
+        // 一般形、七対子、国士無双のうち最小のシャンテン数
+        // 受け入れ牌は最小を与える形の受け入れ牌の和
+        int steps = calcNormalMinimumSteps(hand, info, records, pac);
+        if(hand.openedMelds() != 0){ return steps; } // 副露していれば一般形のみ
+        
+        PieceExistance acc;
+        const int sp = calcSevenPairsMinimumSteps(hand, &acc);
+        if(sp < steps){
+            steps = sp;
+            *pac = acc;
+        }else if(sp == steps){
+            *pac |= acc;
+        }
+        const int to = calcThirteenOrphansMinimumSteps(hand, &acc);
+        if(to < steps){
+            steps = to;
+            *pac = acc;
+        }else if(to == steps){
+            *pac |= acc;
+        }
+        return steps;
+    }
+    
+    template<class hand_t>
+    int calcMinimumSteps(const hand_t& hand, const StepsInfoRecord *const *const records, PieceExistance *const pac){
+        const uint32_t info[N_NUMBER_PIECE_TYPES] = {records[0]->steps, records[1]->steps, records[2]->steps}; // テーブルを引く
+        return calcMinimumSteps(hand, info, records, pac);
+    }
+    
+    template<class hand_t>
+    int calcMinimumSteps(const hand_t& hand, PieceExistance *const pac){
+        if(!stepsTablesReady.load(std::memory_order_acquire)){ waitStepsTables(); }
+        const StepsInfoRecord *records[N_NUMBER_PIECE_TYPES];
+        prefetchStepsInfo(hand, records);
+        return calcMinimumSteps(hand, records, pac);
+    }
+    
+    template<class hand_t>
+    void calcMinimumStepsBatch(const hand_t *const hands, int n, int *const steps, PieceExistance *const pac){
+        // 複数の手牌のシャンテン数をまとめて計算する
+        // k番目をデコードしている間に k+1番目のレコードを読み込ませておく
+        if(n <= 0){ return; }
+        if(!stepsTablesReady.load(std::memory_order_acquire)){ waitStepsTables(); }
+        const StepsInfoRecord *records[2][N_NUMBER_PIECE_TYPES];
+        prefetchStepsInfo(hands[0], records[0]);
+        for(int k = 0; k < n; ++k){
+            if(k + 1 < n){
+                prefetchStepsInfo(hands[k + 1], records[(k + 1) & 1]);
+            }
+            steps[k] = calcMinimumSteps(hands[k], records[k & 1], pac + k);
+        }
+    }
+    
+    struct StepsHandView{
+        // シャンテン数計算で参照する手牌の要素だけを持つ
+        uint64_t pqr[N_PIECE_TYPES], sc[N_PIECE_TYPES];
+        int opened;
+        
+        int openedMelds()const noexcept{ return opened; }
+        void sub(PieceType pt, Rank r)noexcept{
+            // 1枚減らす(最後の1枚ならマスクで消える)
+            const uint64_t rankMask = rankMask4(r);
+            const uint64_t opqr = pqr[pt];
+            pqr[pt] = (opqr & ~rankMask) | (((opqr & rankMask) >> 1) & rankMask);
+            sc[pt] -= opqr & rankMask;
+        }
+    };
+    
+    struct DiscardStepsInfo{
+        // 打牌候補ごとの打牌後のシャンテン数と受け入れ牌
+        // 添字は Piece で、candidates に立っている牌だけが有効
+        PieceExistance candidates;
+        int steps[PIECE_MAX + 1];
+        PieceExistance acceptable[PIECE_MAX + 1];
+    };
+    
+    template<class hand_t>
+    int calcDiscardMinimumSteps(const hand_t& hand, DiscardStepsInfo *const pinfo){
+        // 手牌から1枚捨てたときのシャンテン数を、捨てられる牌の種類すべてについて計算する
+        // 数牌を捨てた場合に変わるのはその種類の添字だけで、その steps はレコードの removed に
+        // 辞書番号で入っているので表を引き直さずに済む
+        // 受け入れを引く1枚少ない形のレコードはデコードの間に読み込ませておく
+        // 返り値は候補中の最小シャンテン数
+        if(!stepsTablesReady.load(std::memory_order_acquire)){ waitStepsTables(); }
+        constexpr int N_MAX_CANDIDATES = 16; // 手牌は最大14種類
+        const StepsInfoRecord *records[N_NUMBER_PIECE_TYPES];
+        for(PieceType pt = PIECE_TYPE_NUMBERS_MIN; pt <= PIECE_TYPE_NUMBERS_MAX; ++pt){
+            records[pt] = stepsInfoTable + hand.pieceMin[pt].data();
+        }
+        
+        // 数牌の候補を列挙して1枚減らした形のレコードを先読みする
+        Piece numberCandidate[N_MAX_CANDIDATES];
+        const StepsInfoRecord *removedRecord[N_MAX_CANDIDATES];
+        int numbers = 0;
+        pinfo->candidates.reset();
+        for(PieceType pt = PIECE_TYPE_NUMBERS_MIN; pt <= PIECE_TYPE_NUMBERS_MAX; ++pt){
+            uint64_t ex = pext(hand.sc[pt], PQR_1);
+            pinfo->candidates |= ex << toPiece(pt, RANK_MIN);
+            for(; ex; ex &= ex - 1){
+                const Rank r = static_cast<Rank>(bsf(ex));
+                numberCandidate[numbers] = toPiece(pt, r);
+                removedRecord[numbers] = records[pt] - ipow5Table[r];
+                __builtin_prefetch(removedRecord[numbers], 0, 3);
+                numbers += 1;
+            }
+        }
+        
+        StepsHandView view;
+        for(PieceType pt = PIECE_TYPE_MIN; pt <= PIECE_TYPE_MAX; ++pt){
+            view.pqr[pt] = hand.pqr[pt];
+            view.sc[pt] = hand.sc[pt];
+        }
+        view.opened = hand.openedMelds();
+        const uint32_t baseInfo[N_NUMBER_PIECE_TYPES] = {records[0]->steps, records[1]->steps, records[2]->steps};
+        
+        int minSteps = N_DEALT_PIECES + 1;
+        for(int i = 0; i < numbers; ++i){
+            const Piece p = numberCandidate[i];
+            const PieceType pt = toPieceType(p);
+            const Rank r = toRank(p);
+            uint32_t info[N_NUMBER_PIECE_TYPES] = {baseInfo[0], baseInfo[1], baseInfo[2]};
+            const StepsInfoRecord *crecords[N_NUMBER_PIECE_TYPES] = {records[0], records[1], records[2]};
+            info[pt] = records[pt]->removedSteps(r);
+            crecords[pt] = removedRecord[i];
+            StepsHandView v = view;
+            v.sub(pt, r);
+            pinfo->steps[p] = calcMinimumSteps(v, info, crecords, &pinfo->acceptable[p]);
+            minSteps = min(minSteps, pinfo->steps[p]);
+        }
+        // 字牌は数牌のレコードが変わらない
+        uint64_t hex = pext(hand.sc[HONOR], PQR_1);
+        pinfo->candidates |= hex << toPiece(HONOR, RANK_MIN);
+        for(; hex; hex &= hex - 1){
+            const Rank r = static_cast<Rank>(bsf(hex));
+            const Piece p = toPiece(HONOR, r);
+            StepsHandView v = view;
+            v.sub(HONOR, r);
+            pinfo->steps[p] = calcMinimumSteps(v, baseInfo, records, &pinfo->acceptable[p]);
+            minSteps = min(minSteps, pinfo->steps[p]);
+        }
+        return minSteps;
+    }
+    
+    /**************************完成形の分解**************************/
+    
+    // 1種類の数牌を面子と高々1つの雀頭に分ける方法を、steps の表と同じ5進数の添字ごとに全て列挙しておく
+    // 役の判定は分け方を牌番号のビット列に直して演算で行い、再帰的な探索はしない
+    // 表は steps の表と同じスレッドで準備され、waitStepsTables() で待てる
+    
+    constexpr int N_RUN_STARTS = N_RANKS - N_CHOW_PIECES + 1; // 順子の先頭になりうるランク数
+    constexpr int N_MAX_SUIT_MELDS = 4; // 1種類に入りうる最大面子数
+    constexpr int SUIT_DECOMPOSITION_COUNT_BITS = 8;
+    
+    struct SuitDecomposition{
+        // 1種類の数牌の分け方の1つ(ランクごとのビット)
+        uint16_t runs;       // 順子の先頭
+        uint16_t doubleRuns; // 同じ順子が2つ以上ある先頭
+        uint16_t triples;    // 刻子
+        int8_t head;         // 雀頭(無ければ -1)
+        uint8_t melds;       // 面子数
+    };
+    
+    // 上がり牌が面子のどこに入ったか
+    enum WaitShape{
+        WAIT_BOTH_SIDES, // 両面
+        WAIT_CLOSED, // 嵌張
+        WAIT_EDGE, // 辺張
+        WAIT_DOUBLE_PAIR, // 双碰
+        WAIT_SINGLE, // 単騎
+        N_WAIT_SHAPES,
+    };
+    
+    // 添字ごとに (分け方の表の位置 << 8) | 分け方の数 を持つ。完成形でなければ 0
+    uint32_t *suitDecompositionIndex = nullptr;
+    SuitDecomposition *suitDecompositionTable = nullptr;
+    // 分け方ごとに、各ランクの牌で上がったときにありうる待ちの形 (ランクごとに N_WAIT_SHAPES ビット)
+    uint64_t *suitWaitTable = nullptr;
+    int suitDecompositions = 0;
+    
+    constexpr uint32_t WAIT_SHAPES_MASK = (1U << N_WAIT_SHAPES) - 1;
+    
+    uint64_t calcSuitWaits(const SuitDecomposition& d)noexcept{
+        uint64_t waits = 0;
+        for(Rank r = RANK_MIN; r <= RANK_MAX; ++r){
+            uint32_t w = 0;
+            if(d.head == int(r)){ w |= 1U << WAIT_SINGLE; }
+            if(d.triples & (1U << r)){ w |= 1U << WAIT_DOUBLE_PAIR; }
+            if(r >= RANK_MIN + 2 && (d.runs & (1U << (r - 2)))){ // 12 で 3 を待つなら辺張
+                w |= 1U << (r == RANK_MIN + 2 ? WAIT_EDGE : WAIT_BOTH_SIDES);
+            }
+            if(r >= RANK_MIN + 1 && (d.runs & (1U << (r - 1)))){
+                w |= 1U << WAIT_CLOSED;
+            }
+            if(d.runs & (1U << r)){ // 89 で 7 を待つなら辺張
+                w |= 1U << (r == RANK_MAX - 2 ? WAIT_EDGE : WAIT_BOTH_SIDES);
+            }
+            waits |= uint64_t(w) << ((r - RANK_MIN) * N_WAIT_SHAPES);
+        }
+        return waits;
+    }
+    
+    void enumerateSuitDecompositions(int index, int meld, const SuitDecomposition& d,
+                                     std::vector<std::pair<int, SuitDecomposition>> *const pv){
+        // 面子を番号順(順子 0 ~ 6, 刻子 7 ~ 15)に選んでいき、各段階で雀頭の有無を決めて記録する
+        pv->push_back(std::make_pair(index, d));
+        for(Rank r = RANK_MIN; r <= RANK_MAX; ++r){
+            if(rankCountMin(index, r) + 2 <= N_ONE_PIECE){
+                SuitDecomposition h = d;
+                h.head = r;
+                pv->push_back(std::make_pair(index + 2 * ipow5Table[r], h));
+            }
+        }
+        if(d.melds >= N_MAX_SUIT_MELDS){ return; }
+        for(int m = meld; m < N_RUN_STARTS + N_RANKS; ++m){
+            SuitDecomposition next = d;
+            int nindex = index;
+            if(m < N_RUN_STARTS){ // 順子
+                const Rank r = static_cast<Rank>(m);
+                if(rankCountMin(index, r) >= N_ONE_PIECE
+                   || rankCountMin(index, r + 1) >= N_ONE_PIECE
+                   || rankCountMin(index, r + 2) >= N_ONE_PIECE){ continue; }
+                nindex += ipow5Table[r] + ipow5Table[r + 1] + ipow5Table[r + 2];
+                if(next.runs & (1U << r)){ next.doubleRuns |= 1U << r; }
+                next.runs |= 1U << r;
+            }else{ // 刻子
+                const Rank r = static_cast<Rank>(m - N_RUN_STARTS);
+                if(rankCountMin(index, r) + N_PONG_PIECES > N_ONE_PIECE){ continue; }
+                nindex += N_PONG_PIECES * ipow5Table[r];
+                next.triples |= 1U << r;
+            }
+            next.melds += 1;
+            enumerateSuitDecompositions(nindex, m, next, pv);
+        }
+    }
+    
+    int initSuitDecompositionTables(){
+        std::vector<std::pair<int, SuitDecomposition>> v;
+        SuitDecomposition empty;
+        empty.runs = empty.doubleRuns = empty.triples = 0;
+        empty.head = -1;
+        empty.melds = 0;
+        enumerateSuitDecompositions(0, 0, empty, &v);
+        std::stable_sort(v.begin(), v.end(), [](const std::pair<int, SuitDecomposition>& a,
+                                                 const std::pair<int, SuitDecomposition>& b)->bool{
+            return a.first < b.first;
+        });
+        
+        suitDecompositionIndex = (uint32_t*)malloc(sizeof(uint32_t) * N_STEPS_INFO_INDICES);
+        suitDecompositionTable = (SuitDecomposition*)malloc(sizeof(SuitDecomposition) * v.size());
+        suitWaitTable = (uint64_t*)malloc(sizeof(uint64_t) * v.size());
+        if(suitDecompositionIndex == nullptr || suitDecompositionTable == nullptr || suitWaitTable == nullptr){
+            cerr << "failed to allocate decomposition tables." << endl;
+            return -1;
+        }
+        memset(suitDecompositionIndex, 0, sizeof(uint32_t) * N_STEPS_INFO_INDICES);
+        for(int i = 0; i < (int)v.size(); ++i){
+            const int index = v[i].first;
+            suitDecompositionTable[i] = v[i].second;
+            suitWaitTable[i] = calcSuitWaits(v[i].second);
+            if(suitDecompositionIndex[index] == 0){
+                suitDecompositionIndex[index] = uint32_t(i) << SUIT_DECOMPOSITION_COUNT_BITS;
+            }
+            suitDecompositionIndex[index] += 1;
+            if((suitDecompositionIndex[index] & ((1U << SUIT_DECOMPOSITION_COUNT_BITS) - 1)) == 0){
+                cerr << "too many decompositions of " << index << "." << endl;
+                return -1;
+            }
+        }
+        suitDecompositions = v.size();
+        return 0;
+    }
+    
+    struct HandDecomposition{
+        // 手牌全体(鳴いた面子を含む)の分け方の1つ(牌番号のビット)
+        PieceExistance runs;             // 順子の先頭
+        PieceExistance doubleRuns;       // 同じ順子が2つ以上ある先頭
+        PieceExistance triples;          // 刻子と槓子
+        PieceExistance concealedTriples; // 鳴いていない刻子と暗槓
+        Piece head;
+        uint32_t suit[N_NUMBER_PIECE_TYPES]; // 数牌の種類ごとの分け方の表の位置
+    };
+    
+    constexpr BitSet64 PIECE_EXISTANCE_ORPHANS = (PIECE_EXISTANCE_MASK_NUMBERS & (PIECE_EXISTANCE_BASE * ((1ULL << RANK_MIN) | (1ULL << RANK_MAX))))
+                                                 | PIECE_EXISTANCE_HONORS;
+    constexpr BitSet64 PIECE_EXISTANCE_OUTSIDE_RUNS = PIECE_EXISTANCE_MASK_NUMBERS & (PIECE_EXISTANCE_BASE * ((1ULL << RANK_MIN) | (1ULL << (N_RUN_STARTS - 1))));
+    constexpr uint64_t TYPE_EXISTANCE_FULL_STRAIGHT = (1ULL << 0) | (1ULL << 3) | (1ULL << 6); // 123 456 789
+    
+    template<class hand_t, class callback_t>
+    int iterateDecompositions(const hand_t& hand, const callback_t& callback){
+        // 一般形の完成形としての分け方を全て callback に渡す
+        // 返り値は分け方の数で、0 なら一般形で上がっていない
+        // 字牌は刻子か雀頭にしかならないので分け方は1通り
+        const uint64_t honorPqr = hand.pqr[HONOR];
+        if(honorPqr & (PQR_1 | PQR_4)){ return 0; }
+        if(!stepsTablesReady.load(std::memory_order_acquire)){ waitStepsTables(); }
+        const uint64_t honorPairs = pext(honorPqr, PQR_2);
+        int honorHeads = countBits64(honorPairs);
+        if(honorHeads > 1){ return 0; }
+        
+        uint32_t suit[N_NUMBER_PIECE_TYPES];
+        int n[N_NUMBER_PIECE_TYPES];
+        for(PieceType pt = PIECE_TYPE_NUMBERS_MIN; pt <= PIECE_TYPE_NUMBERS_MAX; ++pt){
+            const uint32_t entry = suitDecompositionIndex[hand.pieceMin[pt].data()];
+            n[pt] = entry & ((1U << SUIT_DECOMPOSITION_COUNT_BITS) - 1);
+            if(n[pt] == 0){ return 0; }
+            suit[pt] = entry >> SUIT_DECOMPOSITION_COUNT_BITS;
+        }
+        
+        // 鳴いた面子と字牌の部分は全ての分け方で共通
+        HandDecomposition base;
+        base.runs.reset();
+        base.doubleRuns.reset();
+        for(PieceType pt = PIECE_TYPE_NUMBERS_MIN; pt <= PIECE_TYPE_NUMBERS_MAX; ++pt){
+            const uint64_t qr = hand.openedSeqQr[pt]; // 順子の先頭ごとの個数
+            base.runs |= pext((qr | (qr >> 1) | (qr >> 2)) & PQR_1, PQR_1) << toPiece(pt, RANK_MIN);
+            base.doubleRuns |= pext(((qr >> 1) | (qr >> 2)) & PQR_1, PQR_1) << toPiece(pt, RANK_MIN);
+        }
+        base.concealedTriples = (pext(honorPqr, PQR_3) << toPiece(HONOR, RANK_MIN)) | hand.concealedKong;
+        base.triples = base.concealedTriples | hand.openedGroupAll();
+        base.head = honorHeads ? toPiece(HONOR, static_cast<Rank>(bsf(honorPairs))) : PIECE_NONE;
+        
+        int count = 0;
+        for(int i0 = 0; i0 < n[0]; ++i0){
+            const SuitDecomposition& d0 = suitDecompositionTable[suit[0] + i0];
+            const int heads0 = honorHeads + (d0.head >= 0);
+            if(heads0 > 1){ continue; }
+            for(int i1 = 0; i1 < n[1]; ++i1){
+                const SuitDecomposition& d1 = suitDecompositionTable[suit[1] + i1];
+                const int heads1 = heads0 + (d1.head >= 0);
+                if(heads1 > 1){ continue; }
+                for(int i2 = 0; i2 < n[2]; ++i2){
+                    const SuitDecomposition& d2 = suitDecompositionTable[suit[2] + i2];
+                    if(heads1 + (d2.head >= 0) != 1){ continue; }
+                    const SuitDecomposition *const d[N_NUMBER_PIECE_TYPES] = {&d0, &d1, &d2};
+                    HandDecomposition hd = base;
+                    PieceExistance runs(0), doubleRuns(0), triples(0);
+                    for(PieceType pt = PIECE_TYPE_NUMBERS_MIN; pt <= PIECE_TYPE_NUMBERS_MAX; ++pt){
+                        runs |= uint64_t(d[pt]->runs) << toPiece(pt, RANK_MIN);
+                        doubleRuns |= uint64_t(d[pt]->doubleRuns) << toPiece(pt, RANK_MIN);
+                        triples |= uint64_t(d[pt]->triples) << toPiece(pt, RANK_MIN);
+                        if(d[pt]->head >= 0){ hd.head = toPiece(pt, static_cast<Rank>(d[pt]->head)); }
+                    }
+                    hd.doubleRuns |= doubleRuns | (runs & base.runs);
+                    hd.runs |= runs;
+                    hd.suit[0] = suit[0] + i0;
+                    hd.suit[1] = suit[1] + i1;
+                    hd.suit[2] = suit[2] + i2;
+                    hd.triples |= triples;
+                    hd.concealedTriples |= triples;
+                    callback(hd);
+                    count += 1;
+                }
+            }
+        }
+        return count;
+    }
+    
+    // 待ちの形
+    uint32_t calcWaitShapes(const HandDecomposition& hd, Piece w)noexcept{
+        // 分け方 hd の中で上がり牌 w が入りうる待ちの形のビット集合
+        // hd は iterateDecompositions で作ったもの(表の準備を待った後)に限る
+        ASSERT(stepsTablesReady.load(std::memory_order_acquire),);
+        if(isHonor(w)){
+            return (hd.head == w ? (1U << WAIT_SINGLE) : 0U)
+            | (hd.concealedTriples.test(w) ? (1U << WAIT_DOUBLE_PAIR) : 0U);
+        }
+        return uint32_t(suitWaitTable[hd.suit[toPieceType(w)]] >> ((toRank(w) - RANK_MIN) * N_WAIT_SHAPES)) & WAIT_SHAPES_MASK;
+    }
+    uint32_t calcSuitWaitShapes(uint32_t index, Rank r)noexcept{
+        // 聴牌形の1種類の数牌(5進数の添字)に r を足して完成形になるときの待ちの形のビット集合
+        // 他の種類との雀頭の兼ね合いは見ないので、雀頭の有無が違う分け方の待ちも含む
+        if(rankCountMin(index, r) >= N_ONE_PIECE){ return 0; }
+        if(!stepsTablesReady.load(std::memory_order_acquire)){ waitStepsTables(); }
+        const uint32_t entry = suitDecompositionIndex[index + ipow5Table[r]];
+        const uint32_t offset = entry >> SUIT_DECOMPOSITION_COUNT_BITS;
+        const int n = entry & ((1U << SUIT_DECOMPOSITION_COUNT_BITS) - 1);
+        uint32_t waits = 0;
+        for(int i = 0; i < n; ++i){
+            waits |= uint32_t(suitWaitTable[offset + i] >> ((r - RANK_MIN) * N_WAIT_SHAPES));
+        }
+        return waits & WAIT_SHAPES_MASK;
+    }
+    
+    // 分け方から判定
+    bool isDoubleRun(const HandDecomposition& hd)noexcept{ // 一盃口
+        return hd.doubleRuns.any();
+    }
+    bool isFullStraight(const HandDecomposition& hd)noexcept{ // 一気通貫
+        for(PieceType pt = PIECE_TYPE_NUMBERS_MIN; pt <= PIECE_TYPE_NUMBERS_MAX; ++pt){
+            if(holdsBits(uint64_t(hd.runs) >> toPiece(pt, RANK_MIN), TYPE_EXISTANCE_FULL_STRAIGHT)){ return true; }
+        }
+        return false;
+    }
+    bool isThreeColorRuns(const HandDecomposition& hd)noexcept{ // 三色同順
+        const uint64_t runs = hd.runs;
+        return (runs & (runs >> 16) & (runs >> 32) & uint64_t(TYPE_EXISTANCE_RUN_NUMBERS)) != 0;
+    }
+    bool isAllTriples(const HandDecomposition& hd)noexcept{ // 対々和
+        return !hd.runs.any();
+    }
+    bool isOutsideHand(const HandDecomposition& hd)noexcept{ // 混全帯么九(純全帯么九を含む)
+        // 順子が無いものは么九牌の刻子だけの混老頭なので含めない
+        return hd.runs.any() && hd.head != PIECE_NONE && PIECE_EXISTANCE_ORPHANS.test(hd.head)
+        && !(hd.runs & ~PIECE_EXISTANCE_OUTSIDE_RUNS)
+        && !(hd.triples & ~PIECE_EXISTANCE_ORPHANS);
+    }
+    bool isPureOutsideHand(const HandDecomposition& hd)noexcept{ // 純全帯么九
+        return isOutsideHand(hd) && !isHonor(hd.head) && !(hd.triples & PIECE_EXISTANCE_HONORS);
+    }
+    
     /**************************牌集合からの性質計算**************************/
     
     // qrから判定
     bool isAllInsideNumbers(const PieceSet& ps)noexcept{ // 断么
         return holds(NAIVE_MASK_INSIDE_NUMBERS, ps);
     }
-    bool isAllDoubles(const PieceSet& ps)noexcept{ // 七対子
-        // 同じ牌4つを2-2とはできないのでこれでOK
-        return holds(PIECE_SET_DOUBLE, ps);
-    }
     
     // pqrから判定
+    bool isAllDoublesPqr(const PieceSet& pqr)noexcept{ // 七対子
+        // 全ての牌が0枚か2枚
+        // 同じ牌4つを2-2とはできないのでこれでOK
+        return holds(PQR256_DOUBLE, pqr);
+    }
     bool is9Types9PiecesPqr(const PieceSet& pqr)noexcept{ // 九種九牌
         return (pqr & NAIVE_MASK_9T9P).sum1() >= 9;
     }
@@ -2018,6 +3125,20 @@ namespace Mahjong{
         return holds(sc, SET_SC_FULL_ORPHANS);
     }
     
+    // 存在型と枚数から
+    int countPieces(const PieceSet& ps, PieceExistance pe)noexcept{
+        // pe に立っている種類の牌が ps に何枚あるか(受け入れ牌の残り枚数など)
+        // 種類ごとに存在ビットを4ビットのマスクに広げ、4ビットずつの枚数をまとめて足す
+        int n = 0;
+        for(PieceType pt = PIECE_TYPE_MIN; pt <= PIECE_TYPE_MAX; ++pt){
+            const uint64_t bits = (uint64_t(pe) >> toPiece(pt, RANK_MIN)) & ((1ULL << 16) - 1);
+            uint64_t x = uint64_t(ps[pt]) & (_pdep_u64(bits, PQR_1) * 15ULL);
+            x = (x & 0x0f0f0f0f0f0f0f0fULL) + ((x >> 4) & 0x0f0f0f0f0f0f0f0fULL); // 8ビットごとの和
+            n += (x * 0x0101010101010101ULL) >> 56; // 種類ごとに高々36枚なので桁あふれしない
+        }
+        return n;
+    }
+    
     /**************************牌のランダム分配**************************/
     
     // 牌を一つランダムに取り出す
@@ -96,6 +96,306 @@ namespace Mahjong{
     
     /**************************得点計算**************************/
     
+    int calcDecompositionBonus(const HandDecomposition& hd, bool concealed, BonusStatus *const pbs){
+        // 面子の分け方で決まる役の翻数
+        int bonus = 0;
+        if(concealed && isDoubleRun(hd)){ // 一盃口
+            pbs->set(DOUBLE_RUN); bonus += 1;
+        }
+        if(isFullStraight(hd)){ // 一気通貫
+            pbs->set(FULL_STRAIGHT); bonus += concealed ? 2 : 1;
+        }
+        if(isThreeColorRuns(hd)){ // 三色同順
+            pbs->set(THREE_COLOR_RUNS); bonus += concealed ? 2 : 1;
+        }
+        if(isAllTriples(hd)){ // 対々和
+            pbs->set(ALL_TRIPLES); bonus += 2;
+        }
+        if(isPureOutsideHand(hd)){ // 純全帯么九
+            pbs->set(PURE_OUTSIDE_HAND); bonus += concealed ? 3 : 2;
+        }else if(isOutsideHand(hd)){ // 混全帯么九
+            pbs->set(MIXED_OUTSIDE_HAND); bonus += concealed ? 2 : 1;
+        }
+        return bonus;
+    }
+    
+    /**************************得点表**************************/
+    
+    // 翻数と符から基本点を引く表
+    // 支払いは基本点に 子のロン 4倍, 親のロン 6倍, ツモは親 2倍 子 1倍 を掛けて100点単位に切り上げる
+    // 七対子の25符があるので符は5で割った添字で引く
+    
+    constexpr int N_TABLE_BONUS = 13; // 13翻以上は数え役満
+    constexpr int N_TABLE_FU = 110 / 5 + 1;
+    constexpr int BASIC_POINT_FULL_BONUS = 8000; // 役満1倍
+    
+    struct ScorePointTable{
+        int point[N_TABLE_BONUS + 1][N_TABLE_FU];
+        
+        constexpr ScorePointTable():point(){
+            for(int b = 0; b <= N_TABLE_BONUS; ++b){
+                for(int f = 0; f < N_TABLE_FU; ++f){
+                    int p = 0;
+                    if(b >= 13){ p = 8000; } // 数え役満
+                    else if(b >= 11){ p = 6000; } // 三倍満
+                    else if(b >= 8){ p = 4000; } // 倍満
+                    else if(b >= 6){ p = 3000; } // 跳満
+                    else if(b >= 5){ p = 2000; } // 満貫
+                    else{
+                        p = f * 5 * (1 << (b + 2));
+                        if(p > 2000){ p = 2000; } // 満貫で頭打ち
+                    }
+                    point[b][f] = p;
+                }
+            }
+        }
+        constexpr int operator ()(int bonus, int fu)const{
+            return point[bonus < N_TABLE_BONUS ? bonus : N_TABLE_BONUS][fu / 5];
+        }
+    };
+    
+    constexpr ScorePointTable scorePointTable;
+    
+    constexpr int ceilScore100(int p)noexcept{ // 100点単位に切り上げ
+        return (p + 99) / 100 * 100;
+    }
+    
+    /**************************上がり形の評価**************************/
+    
+    struct WinContext{
+        // 手牌以外で上がり形の点数に関わる情報
+        Piece winning; // 上がり牌
+        bool drawWin; // ツモ上がり
+        bool concealed; // 門前
+        Piece ownWind, fieldWind; // 自風牌と場風牌
+    };
+    
+    struct WinScore{
+        // 手牌と上がり方だけで決まる部分の点数
+        // リーチ、一発、海底河底、天和地和とドラは含まない
+        BonusStatus status;
+        int bonus; // 翻数
+        int fu; // 符
+        int fullBonus; // 役満の倍数(役満でなければ 0)
+        
+        int basicPoint(int extraBonus)const{
+            if(fullBonus){ return BASIC_POINT_FULL_BONUS * fullBonus; }
+            return scorePointTable(bonus + extraBonus, fu);
+        }
+        bool isWin()const noexcept{ // 上がり形として評価できたか
+            return fullBonus > 0 || fu > 0;
+        }
+        bool operator <(const WinScore& ws)const noexcept{
+            // ドラ等が後から足されるので翻数を優先して比べる
+            if(fullBonus != ws.fullBonus){ return fullBonus < ws.fullBonus; }
+            if(bonus != ws.bonus){ return bonus < ws.bonus; }
+            return fu < ws.fu;
+        }
+    };
+    
+    constexpr BitSet64 PIECE_EXISTANCE_DRAGONS = ((1ULL << N_DRAGONS) - 1) << PIECE_DRAGON_MIN;
+    
+    int countValuePieces(Piece p, const WinContext& wc)noexcept{ // 役牌として何役分か(連風牌は2)
+        return int(isDragonPiece(p)) + int(p == wc.ownWind) + int(p == wc.fieldWind);
+    }
+    
+    template<class hand_t>
+    int calcWinFu(const hand_t& hand, const HandDecomposition& hd, PieceExistance concealedTriples,
+                  WaitShape wait, const WinContext& wc){
+        // 平和以外の符計算
+        // 暗槓は concealedTriples と openedGroup[1] の両方に入るので 16 符(么九牌は 32 符)になる
+        int fu = 20; // 副底
+        for(uint64_t t = hd.triples; t; t &= t - 1){
+            const Piece p = static_cast<Piece>(bsf(t));
+            int f = PIECE_EXISTANCE_ORPHANS.test(p) ? 4 : 2;
+            if(concealedTriples.test(p)){ f *= 2; }
+            if(hand.openedGroup[1].test(p)){ f *= 4; }
+            fu += f;
+        }
+        fu += 2 * countValuePieces(hd.head, wc); // 役牌の雀頭
+        if(wait == WAIT_CLOSED || wait == WAIT_EDGE || wait == WAIT_SINGLE){ fu += 2; }
+        if(wc.drawWin){
+            fu += 2; // ツモ
+        }else if(wc.concealed){
+            fu += 10; // 門前ロン
+        }
+        if(fu == 20){ fu = 30; } // 鳴いた平和形のロン
+        return (fu + 9) / 10 * 10;
+    }
+    
+    template<class hand_t>
+    WinScore evalWinScore(const hand_t& hand, const WinContext& wc){
+        // 上がり牌を含む14枚(鳴いた面子を含む)の手牌の点数を、分け方と上がり牌の位置ごとに調べて最も高いものを返す
+        // 一般形、七対子、国士無双のどれでもなければ fu = 0 のまま返すので isWin() が偽になる
+        WinScore best;
+        best.status.reset();
+        best.bonus = 0;
+        best.fu = 0;
+        best.fullBonus = 0;
+        
+        if(wc.concealed && isFullOrphansSc(hand.sc)){ // 国士無双
+            best.status.set(FULL_ORPHANS);
+            best.fullBonus = 1;
+            return best;
+        }
+        
+        // 分け方によらない役
+        BonusStatus common(0);
+        int commonBonus = 0;
+        const ExtPieceSet myAll = hand.piece + hand.openedPiece;
+        if(wc.concealed && wc.drawWin){ // 門前清自摸和
+            common.set(CONCEALED_DRAW); commonBonus += 1;
+        }
+        if(isAllInsideNumbers(myAll)){ // 断么
+            common.set(ALL_SIMPLES); commonBonus += 1;
+        }
+        int numberTypes = 0;
+        for(PieceType pt = PIECE_TYPE_NUMBERS_MIN; pt <= PIECE_TYPE_NUMBERS_MAX; ++pt){
+            numberTypes += myAll[pt].any() ? 1 : 0;
+        }
+        if(numberTypes == 1){
+            if(myAll[HONOR].any()){ // 混一色
+                common.set(HALF_FLUSH); commonBonus += wc.concealed ? 3 : 2;
+            }else{ // 清一色
+                common.set(FULL_FLUSH); commonBonus += wc.concealed ? 6 : 5;
+            }
+        }
+        
+        if(wc.concealed && isAllDoublesPqr(hand.pqr)){ // 七対子
+            best.status = common;
+            best.status.set(ALL_DOUBLES);
+            best.bonus = commonBonus + 2;
+            best.fu = 25;
+        }
+        
+        const Piece w = wc.winning;
+        iterateDecompositions(hand, [&](const HandDecomposition& hd)->void{
+            auto evalPlacement = [&](WaitShape wait)->void{
+                WinScore ws;
+                ws.status.reset();
+                ws.bonus = 0;
+                ws.fu = 0;
+                ws.fullBonus = 0;
+                // ロンで双碰待ちを上がった刻子は暗刻にならない
+                PieceExistance concealedTriples = hd.concealedTriples;
+                if(!wc.drawWin && wait == WAIT_DOUBLE_PAIR){ concealedTriples.reset(w); }
+                
+                // 役満
+                if(countBits(hd.triples & PIECE_EXISTANCE_DRAGONS) == N_DRAGONS){ // 大三元
+                    ws.status.set(FULL_HONORS); ws.fullBonus += 1;
+                }
+                if(wc.concealed && countBits(concealedTriples) == N_DEALT_PIECES / N_PONG_PIECES){
+                    if(wait == WAIT_SINGLE){ // 四暗刻単騎待ち
+                        ws.status.set(ALL_CONCEALED_TRIPLES_HEAD); ws.fullBonus += 2;
+                    }else{ // 四暗刻
+                        ws.status.set(ALL_CONCEALED_TRIPLES); ws.fullBonus += 1;
+                    }
+                }
+                if(ws.fullBonus){
+                    if(best < ws){ best = ws; }
+                    return;
+                }
+                
+                ws.status = common;
+                ws.bonus = commonBonus + calcDecompositionBonus(hd, wc.concealed, &ws.status);
+                const int pfc = countBits(hd.triples & PIECE_EXISTANCE_DRAGONS);
+                if(pfc){ // 三元牌の役
+                    ws.status.set(BONUS_PFC); ws.bonus += pfc;
+                }
+                if(hd.triples.test(wc.ownWind)){ // 門風牌
+                    ws.status.set(OWN_WIND); ws.bonus += 1;
+                }
+                if(hd.triples.test(wc.fieldWind)){ // 荘風牌
+                    ws.status.set(FIELD_WIND); ws.bonus += 1;
+                }
+                if(countBits(concealedTriples) >= 3){ // 三暗刻
+                    ws.status.set(THREE_CONCEALED_TRIPLES); ws.bonus += 2;
+                }
+                if(wc.concealed && !hd.triples.any() && wait == WAIT_BOTH_SIDES
+                   && countValuePieces(hd.head, wc) == 0){ // 平和
+                    ws.status.set(ALL_RUNS); ws.bonus += 1;
+                    ws.fu = wc.drawWin ? 20 : 30;
+                }else{
+                    ws.fu = calcWinFu(hand, hd, concealedTriples, wait, wc);
+                }
+                if(best < ws){ best = ws; }
+            };
+            
+            // 上がり牌が入りうる全ての位置を試す
+            for(uint32_t waits = calcWaitShapes(hd, w); waits; waits &= waits - 1){
+                evalPlacement(static_cast<WaitShape>(bsf(waits)));
+            }
+        });
+        return best;
+    }
+    
+    struct WinScoreMemo{
+        // 手牌のハッシュキーと上がり方ごとに evalWinScore() の結果を覚えておく
+        // 同じ局面からのシミュレーションでは上がり形が重なりやすい
+        // キーの衝突は確認しないが64ビットなので無視する
+        static constexpr int SIZE_LOG2 = 12;
+        static constexpr int SIZE = 1 << SIZE_LOG2;
+        struct Entry{
+            uint64_t key; // 0 なら空
+            WinScore score;
+        };
+        std::array<Entry, SIZE> entry;
+        uint64_t hits, misses;
+        
+        WinScoreMemo(){
+            clear();
+        }
+        void clear()noexcept{
+            for(Entry& e : entry){ e.key = 0; }
+            hits = misses = 0;
+        }
+        double hitRate()const{
+            return (hits + misses) == 0 ? 0 : hits / double(hits + misses);
+        }
+        template<class hand_t>
+        static uint64_t toKey(const hand_t& hand, uint64_t pieceHashKey, const WinContext& wc)noexcept{
+            uint64_t key = pieceHashKey;
+            auto mix = [&key](uint64_t x)->void{
+                key = (key ^ x) * 0x9e3779b97f4a7c15ULL;
+                key ^= key >> 29;
+            };
+            mix(uint64_t(hand.openedGroup[0]));
+            mix(uint64_t(hand.openedGroup[1]));
+            mix(uint64_t(hand.concealedKong));
+            for(PieceType pt = PIECE_TYPE_NUMBERS_MIN; pt <= PIECE_TYPE_NUMBERS_MAX; ++pt){
+                mix(uint64_t(hand.openedSeqQr[pt]));
+            }
+            mix(uint64_t(wc.winning)
+                | (uint64_t(wc.drawWin) << 8) | (uint64_t(wc.concealed) << 9)
+                | (uint64_t(wc.ownWind) << 16) | (uint64_t(wc.fieldWind) << 24));
+            return key | 1;
+        }
+        template<class hand_t>
+        const WinScore& get(const hand_t& hand, ExtPiece winning, bool winningInHand, const WinContext& wc){
+            // winningInHand が偽なら hand に上がり牌を足した形で評価する
+            const uint64_t handKey = winningInHand ? hand.pieceHashKey : (hand.pieceHashKey + pieceHashTable[winning]);
+            const uint64_t key = toKey(hand, handKey, wc);
+            Entry& e = entry[(key >> (64 - SIZE_LOG2)) & (SIZE - 1)];
+            if(e.key == key){
+                hits += 1;
+                return e.score;
+            }
+            misses += 1;
+            e.key = key;
+            if(winningInHand){
+                e.score = evalWinScore(hand, wc);
+            }else{
+                hand_t whand = hand;
+                whand.add(winning);
+                e.score = evalWinScore(whand, wc);
+            }
+            return e.score;
+        }
+    };
+    
+    // シミュレーション中にも使えるようにスレッドごとに持つ
+    thread_local WinScoreMemo winScoreMemo;
+    
     template<class field_t>
     void calcScoreIrregularDraw(field_t *const pfield){ // 途中流局時
         // 得点移動なし
@@ -140,64 +440,139 @@ namespace Mahjong{
         }
     }
     
+    struct WinResult{
+        // 1人分の上がりの役と点数の元
+        BonusStatus status;
+        int bonus; // ドラを含む翻数
+        int fu; // 符
+        int fullBonus; // 役満の倍数(役満でなければ 0)
+    };
+    
+    template<class field_t>
+    bool evalWin(const field_t& field, Player pn, bool drawWin, WinResult *const pwr){
+        // pn の上がりの役と翻数を求める
+        // 手牌と上がり方で決まる部分は winScoreMemo で使い回し、状況役とドラはここで足す
+        // 上がり形でないか役が無ければ偽を返す
+        const Player turnPlayer = field.turnPlayer; // ツモ上がりなら上がった人、ロンなら放銃した人
+        const ExtPiece winning = drawWin ? field.wall[wallIndexTurn(field.turn)]
+                                         : field.lastDiscarded(turnPlayer);
+        Hand handBuffer;
+        const Hand& hand = toFullHand(field.hand[pn], &handBuffer); // SimHand なら変換する
+        
+        // リーチ中のツモとロンでは上がり牌は手牌に入っていない
+        int concealedPieces = 0;
+        for(PieceType pt = PIECE_TYPE_MIN; pt <= PIECE_TYPE_MAX; ++pt){
+            concealedPieces += countBits64(hand.sc[pt]);
+        }
+        const bool winningInHand = (concealedPieces % N_PONG_PIECES) != 1;
+        
+        WinContext wc;
+        wc.winning = toPiece(winning);
+        wc.drawWin = drawWin;
+        wc.concealed = field.isConcealed(pn);
+        wc.ownWind = toWindPiece(field.playerWind(pn));
+        wc.fieldWind = toWindPiece(field.fieldWind);
+        const WinScore& ws = winScoreMemo.get(hand, winning, winningInHand, wc);
+        if(!ws.isWin()){ return false; }
+        
+        BonusStatus bs = ws.status;
+        int bonus = ws.bonus;
+        int fullBonus = ws.fullBonus;
+        
+        // 状況で決まる役
+        if(drawWin && field.lastResponseTurn < 0){
+            if(field.turn == 0){ // 天和
+                bs.set(HEAVEN_OWNER); fullBonus += 1;
+            }else if(field.isFirstTurn()){ // 地和
+                bs.set(HEAVEN_GENERAL); fullBonus += 1;
+            }
+        }
+        if(field.isInReach(pn)){ // リーチ
+            bs.set(BONUS_REACH); bonus += 1;
+            if(field.isImmediate(pn)){ // リーチ一発
+                bs.set(IMMEDIATE); bonus += 1;
+            }
+        }
+        if(field.turn >= N_TURNS - 1){
+            if(drawWin){ // 海底
+                bs.set(LAST_DRAW_WIN); bonus += 1;
+            }else{ // 河底
+                bs.set(LAST_RESPONSE_WIN); bonus += 1;
+            }
+        }
+        if(!finishBonus(bs)){ return false; } // 役無し(ドラだけでは上がれない)
+        
+        // ドラ
+        const ExtPieceSet myAll = hand.piece + hand.openedPiece;
+        int doras = 0;
+        iteratePieceWithQty(field.dora, [&](Piece p, int q)->void{
+            doras += q * (myAll[p] + int(!winningInHand && p == wc.winning));
+        });
+        if(doras){ bs.set(NORMAL_DORA); bonus += doras; }
+        const int reds = hand.countAllReds() + int(!winningInHand && isRed(winning));
+        if(reds){ bs.set(RED_DORA); bonus += reds; }
+        
+        pwr->status = bs;
+        pwr->bonus = bonus;
+        pwr->fu = ws.fu;
+        pwr->fullBonus = fullBonus;
+        return true;
+    }
+    
+    template<class field_t>
+    bool isValidWin(const field_t& field, Player pn, bool drawWin){
+        // 上がりを宣言できるか(上がり形で役がある)
+        WinResult wr;
+        return evalWin(field, pn, drawWin, &wr);
+    }
+    
     template<class field_t>
     int calcScoreWin(field_t *const pfield, BitSet32 wonPlayers, bool drawWin,
                      std::array<BonusStatus, N_PLAYERS> *const pstatus){
         // 得点計算
         // 計算が複雑なのでここで足し引き全部やってしまう
-        while(wonPlayers.any()){
-            const Player pn = wonPlayers.bsf();
-            wonPlayers.pop_lsb();
-            BonusStatus bs(0);
-            int bonus = 0;
-            const int maxBonus = 100;
-            Score score = static_cast<Score>(0);
-            const Hand& hand = pfield->hand[pn];
-            
-            PieceSet mine = hand.piece;
-            const ExtPieceSet myAll = hand.piece + hand.openedPiece;
-            const bool concealed = pfield->isConcealed(pn);
+        // 上がり形でないプレーヤーがいれば点数を動かさずに -1 を返す
+        const Player turnPlayer = pfield->turnPlayer; // ツモ上がりなら上がった人、ロンなら放銃した人
+        std::array<WinResult, N_PLAYERS> result;
+        for(Player pn = 0; pn < N_PLAYERS; ++pn){
+            if(!wonPlayers.test(pn)){ continue; }
+            if(!evalWin(*pfield, pn, drawWin, &result[pn])){
+                DERR << "calcScoreWin() : player " << pn << " has no winning hand." << endl;
+                return -1;
+            }
+        }
+        const bool ownerWon = wonPlayers.test(pfield->owner);
+        bool first = true; // 積み棒とリーチ棒は放銃者から近い上がりプレーヤーが総取り
+        for(Player i = 0; i < N_PLAYERS; ++i){
+            const Player pn = static_cast<Player>((turnPlayer + i) % N_PLAYERS);
+            if(!wonPlayers.test(pn)){ continue; }
+            const WinResult& wr = result[pn];
+            (*pstatus)[pn] = wr.status;
             
-            while(1){
-                // 得点の高い役が優先されることがあるのでその順で考える
-                if(pfield->lastResponseTurn < 0){
-                    if(pfield->turn == 0){ // 天和
-                        bs.set(HEAVEN_OWNER); bonus = maxBonus; break;
-                    }
-                    if(pfield->isFirstTurn()){ // 地和
-                        bs.set(HEAVEN_GENERAL); bonus = maxBonus; break;
-                    }
-                }
-                if(concealed && ((hand.pqr & PQR256_124).sum1() == 1)){ // 四暗刻
-                    bs.set(ALL_CONCEALED_TRIPLES); bonus = maxBonus; break;
-                }
-                if(isFullOrphansSc(hand.sc)){ // 国士無双
-                    bs.set(FULL_ORPHANS); bonus = maxBonus; break;
-                }
-                unsigned int pfc = countBits((hand.pqr[HONOR] & TYPE_MASK_DRAGONS_ALL & PQR_34).data()); // 三元牌の役の数
-                if(pfc == N_DRAGONS){ // 大三元
-                    bs.set(FULL_HONORS); bonus = maxBonus; break;
+            // 点数移動
+            const int basic = wr.fullBonus ? (BASIC_POINT_FULL_BONUS * wr.fullBonus)
+                                           : scorePointTable(wr.bonus, wr.fu);
+            const bool owner = (pn == pfield->owner);
+            const int repetition = first ? pfield->repetitionBonus : 0;
+            if(drawWin){
+                for(Player p = 0; p < N_PLAYERS; ++p){
+                    if(p == pn){ continue; }
+                    const int paid = ceilScore100(basic * ((owner || p == pfield->owner) ? 2 : 1))
+                                     + repetition * 100;
+                    pfield->score[p] -= static_cast<Score>(paid);
+                    pfield->score[pn] += static_cast<Score>(paid);
                 }
-                
-                // 役満以外
-                if(pfield->isInReach(pn)){ // リーチ
-                    bs.set(BONUS_REACH); bonus += 1;
-                    if(pfield->isImmediate(pn)){ // リーチ一発
-                        bs.set(IMMEDIATE); bonus += 1;
-                    }
-                }
-                if(isAllDoubles(myAll)){ // 七対子
-                    bs.set(ALL_DOUBLES); bonus += 1;
-                }else{
-                    if(pfc){ // 三元牌の役
-                        bs.set(BONUS_PFC); bonus += pfc;
-                    }
-                }
-                break;
+            }else{
+                const int paid = ceilScore100(basic * (owner ? 6 : 4)) + repetition * 300;
+                pfield->score[turnPlayer] -= static_cast<Score>(paid);
+                pfield->score[pn] += static_cast<Score>(paid);
+            }
+            if(first){ // リーチ棒
+                pfield->score[pn] += static_cast<Score>(pfield->reachBonus * SCORE_REACH);
             }
-            (*pstatus)[pn] = bs;
+            first = false;
         }
-        if(!wonPlayers.test(pfield->owner)){
+        if(!ownerWon){
             // 親が上がりでなければ親交代
             pfield->winToSwitchOwner();
         }else{
@@ -0,0 +1,475 @@
+/*
+ tableFile.hpp
+ Katsuki Ohto
+ */
+
+// 計算用テーブルのバイナリファイル形式
+// 起動の度にテキストを解析しないよう、ファイルを mmap してそのまま使う
+// 同じ形式で POSIX 共有メモリにも置ける
+
+#ifndef MAHJONG_STRUCTURE_TABLEFILE_HPP_
+#define MAHJONG_STRUCTURE_TABLEFILE_HPP_
+
+#include <cerrno>
+#include <chrono>
+#include <thread>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "base.hpp"
+
+namespace Mahjong{
+
+    /**************************テーブルファイル形式**************************/
+
+    // ファイル構成
+    // [TableFileHeader][TableSectionHeader x sections][padding][section 0][padding][section 1]...
+    // 各セクションの先頭は TABLE_SECTION_ALIGNMENT 境界に揃える
+    // エンディアンは実行環境のもの(x86-64 前提)
+
+    constexpr char TABLE_FILE_MAGIC[8] = {'A', 'K', 'N', 'S', 'T', 'B', 'L', '\0'};
+    constexpr uint32_t TABLE_FILE_VERSION = 5; // レイアウトを変えたら上げる
+    constexpr uint32_t TABLE_READY = 0x59444552; // 書き込み完了の印 ("REDY")
+    constexpr uint64_t TABLE_SECTION_ALIGNMENT = 4096;
+    constexpr int N_MAX_TABLE_SECTIONS = 16;
+
+    enum TableSectionID : uint32_t{
+        SECTION_MINIMUM_STEPS_INFO = 0, // minimumStepsInfoTable (version 1)
+        SECTION_ACCEPTABLE_INFO,        // acceptableInfoTable (version 1)
+        SECTION_STEPS_INFO_RECORD,      // StepsInfoRecord
+        SECTION_STEPS_DICTIONARY,       // StepsInfoRecord::removed の番号から steps への辞書
+    };
+
+    struct TableFileHeader{
+        char magic[8];
+        uint32_t version;
+        uint32_t sections;
+        uint64_t fileSize;
+        uint64_t checksum; // セクションヘッダのチェックサムをまとめたもの
+        uint32_t ready;    // 全て書き終えてから TABLE_READY にする(共有メモリでは release で書く)
+        uint32_t reserved;
+    };
+
+    struct TableSectionHeader{
+        uint32_t id;
+        uint32_t elementSize;
+        uint64_t elements;
+        uint64_t offset; // ファイル先頭からの位置
+        uint64_t checksum;
+
+        uint64_t size()const noexcept{ return elementSize * elements; }
+    };
+
+    uint64_t calcTableChecksum(const void *const p, std::size_t size)noexcept{
+        // 4レーンに分けた乗算ハッシュ
+        // 数十MBを起動時に舐めても数ms程度で済む
+        const uint64_t *const q = static_cast<const uint64_t*>(p);
+        const std::size_t n = size / sizeof(uint64_t);
+        uint64_t h[4] = {0x9E3779B97F4A7C15ULL, 0xC2B2AE3D27D4EB4FULL, 0x165667B19E3779F9ULL, 0x27D4EB2F165667C5ULL};
+        std::size_t i = 0;
+        for(; i + 4 <= n; i += 4){
+            for(int l = 0; l < 4; ++l){
+                h[l] = (h[l] ^ q[i + l]) * 0x100000001B3ULL;
+                h[l] ^= h[l] >> 29;
+            }
+        }
+        for(; i < n; ++i){
+            h[0] = (h[0] ^ q[i]) * 0x100000001B3ULL;
+        }
+        // 端数バイト
+        const uint8_t *const r = static_cast<const uint8_t*>(p);
+        for(std::size_t j = n * sizeof(uint64_t); j < size; ++j){
+            h[1] = (h[1] ^ r[j]) * 0x100000001B3ULL;
+        }
+        uint64_t sum = size;
+        for(int l = 0; l < 4; ++l){
+            sum = (sum ^ h[l]) * 0xFF51AFD7ED558CCDULL;
+            sum ^= sum >> 32;
+        }
+        return sum;
+    }
+
+    uint64_t calcHeaderChecksum(const TableSectionHeader *const psh, int sections)noexcept{
+        return calcTableChecksum(psh, sizeof(TableSectionHeader) * sections);
+    }
+
+    constexpr uint64_t alignTableOffset(uint64_t offset)noexcept{
+        return (offset + TABLE_SECTION_ALIGNMENT - 1) / TABLE_SECTION_ALIGNMENT * TABLE_SECTION_ALIGNMENT;
+    }
+
+    /**************************書き出し**************************/
+
+    struct TableSectionSource{
+        uint32_t id;
+        uint32_t elementSize;
+        uint64_t elements;
+        const void *data;
+    };
+
+    struct TableLayout{
+        TableFileHeader header;
+        std::vector<TableSectionHeader> sections;
+    };
+
+    int makeTableLayout(const std::vector<TableSectionSource>& src, TableLayout *const playout){
+        // 各セクションの配置とチェックサムを決める
+        const int sections = src.size();
+        if(sections <= 0 || sections > N_MAX_TABLE_SECTIONS){
+            cerr << "invalid number of table sections " << sections << "." << endl; return -1;
+        }
+        TableFileHeader& header = playout->header;
+        std::vector<TableSectionHeader>& sh = playout->sections;
+        sh.resize(sections);
+        uint64_t offset = alignTableOffset(sizeof(TableFileHeader) + sizeof(TableSectionHeader) * sections);
+        for(int i = 0; i < sections; ++i){
+            sh[i].id = src[i].id;
+            sh[i].elementSize = src[i].elementSize;
+            sh[i].elements = src[i].elements;
+            sh[i].offset = offset;
+            sh[i].checksum = calcTableChecksum(src[i].data, sh[i].size());
+            offset = alignTableOffset(offset + sh[i].size());
+        }
+        memcpy(header.magic, TABLE_FILE_MAGIC, sizeof(header.magic));
+        header.version = TABLE_FILE_VERSION;
+        header.sections = sections;
+        header.fileSize = offset;
+        header.checksum = calcHeaderChecksum(sh.data(), sections);
+        header.ready = TABLE_READY;
+        header.reserved = 0;
+        return 0;
+    }
+
+    int writeTableFile(const std::string& path, const std::vector<TableSectionSource>& src){
+        TableLayout layout;
+        if(makeTableLayout(src, &layout) < 0){ return -1; }
+        const TableFileHeader& header = layout.header;
+        const std::vector<TableSectionHeader>& sh = layout.sections;
+
+        FILE *pf = fopen(path.c_str(), "wb");
+        if(pf == nullptr){
+            cerr << "failed to open " << path << "." << endl; return -1;
+        }
+        static const char zeros[TABLE_SECTION_ALIGNMENT] = {0};
+        uint64_t pos = 0;
+        auto put = [&](const void *p, uint64_t size)->bool{
+            pos += size;
+            return fwrite(p, 1, size, pf) == size;
+        };
+        auto pad = [&](uint64_t to)->bool{
+            return put(zeros, to - pos);
+        };
+        bool ok = put(&header, sizeof(header)) && put(sh.data(), sizeof(TableSectionHeader) * sh.size());
+        for(std::size_t i = 0; ok && i < sh.size(); ++i){
+            ok = pad(sh[i].offset) && put(src[i].data, sh[i].size());
+        }
+        ok = ok && pad(header.fileSize);
+        fclose(pf);
+        if(!ok){
+            cerr << "failed to write " << path << "." << endl; return -1;
+        }
+        return 0;
+    }
+
+    /**************************ヒュージページ**************************/
+
+    // 数十MBのテーブルをランダムに引くので、4KBページだとTLBミスが支配的になる
+    // まず MAP_HUGETLB (予約済みの2MBページ) を試し、駄目なら2MB境界に揃えて madvise(MADV_HUGEPAGE) する
+
+    constexpr std::size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    constexpr std::size_t alignHugePageSize(std::size_t size)noexcept{
+        return (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+    }
+
+    enum TablePageType{
+        PAGE_NORMAL = 0,     // 4KBページ(THPも抑制)
+        PAGE_HUGETLB,        // MAP_HUGETLB
+        PAGE_TRANSPARENT,    // madvise(MADV_HUGEPAGE)
+    };
+
+    void *allocTableMemory(std::size_t size, bool huge, TablePageType *const ptype = nullptr){
+        // 解放は freeTableMemory(p, size)
+        const std::size_t asize = alignHugePageSize(size);
+        if(huge){
+#ifdef MAP_HUGETLB
+            void *p = mmap(nullptr, asize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if(p != MAP_FAILED){
+                if(ptype != nullptr){ *ptype = PAGE_HUGETLB; }
+                return p;
+            }
+#endif
+        }
+        // 2MB境界に揃えるため余分に取って前後を返す
+        void *q = mmap(nullptr, asize + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(q == MAP_FAILED){ return nullptr; }
+        char *const head = static_cast<char*>(q);
+        char *const p = reinterpret_cast<char*>(alignHugePageSize(reinterpret_cast<std::size_t>(head)));
+        if(p != head){ munmap(head, p - head); }
+        munmap(p + asize, head + HUGE_PAGE_SIZE - p);
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+        madvise(p, asize, huge ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+#endif
+        if(ptype != nullptr){ *ptype = huge ? PAGE_TRANSPARENT : PAGE_NORMAL; }
+        return p;
+    }
+
+    void freeTableMemory(void *const p, std::size_t size){
+        if(p != nullptr){
+            munmap(p, alignHugePageSize(size));
+        }
+    }
+
+    /**************************共有メモリ**************************/
+
+    // 同じホストの複数プロセスでテーブルを共有する
+    // 中身はテーブルファイルと同じ形式で、作成したプロセス以外は読み込み専用で attach する
+    // 作成は O_CREAT | O_EXCL で1プロセスだけが行い、書き終えるまで flock を持ち、書き終えたらヘッダの ready を立てる
+    // attach する側は ready が立つまで待つ
+    // ready が立たないまま flock が外れている(作成したプロセスが落ちた)ものと、
+    // 書き終えたが別の版の形式や壊れているものは古いとして消し、呼び出し側で作り直す
+
+    constexpr int SHARED_TABLE_WAIT_MS = 10000; // 作成中の共有メモリを待つ上限
+    constexpr int SHARED_TABLE_ABANDON_MS = 100; // flock が外れたまま ready が立たなければ放棄されたと見なす時間
+
+    // openShared() の返り値
+    // 古い共有メモリを消したか、待っている間に他のプロセスに消されたので作り直せばよい
+    constexpr int SHARED_TABLE_REMOVED = -2;
+
+    inline uint32_t loadTableReady(const TableFileHeader *const ph)noexcept{
+        return __atomic_load_n(&ph->ready, __ATOMIC_ACQUIRE);
+    }
+
+    int removeStaleSharedTable(const std::string& name, const struct stat& st){
+        // name がまだ st と同じ実体を指している場合だけ消す
+        // (他のプロセスが既に消して作り直したものを消さないように)
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if(fd < 0){ return 0; } // 既に消されている
+        struct stat cur;
+        const bool same = fstat(fd, &cur) == 0 && cur.st_dev == st.st_dev && cur.st_ino == st.st_ino;
+        ::close(fd);
+        if(!same){ return 0; }
+        cerr << "remove stale shared tables " << name << "." << endl;
+        return shm_unlink(name.c_str());
+    }
+
+    int publishSharedTable(const std::string& name, const std::vector<TableSectionSource>& src){
+        // 既に存在する場合は -1 (errno == EEXIST)
+        TableLayout layout;
+        if(makeTableLayout(src, &layout) < 0){ return -1; }
+        const TableFileHeader& header = layout.header;
+        const std::vector<TableSectionHeader>& sh = layout.sections;
+
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        if(fd < 0){ return -1; }
+        // 書き終えるまで持つ(プロセスが落ちれば外れる)
+        // shm_open からここまでの間に attach 側が flock を取れても、SHARED_TABLE_ABANDON_MS 待つので放棄とは見なされない
+        if(flock(fd, LOCK_EX) < 0 || ftruncate(fd, header.fileSize) < 0){
+            shm_unlink(name.c_str());
+            ::close(fd);
+            cerr << "failed to resize shared memory " << name << "." << endl; return -1;
+        }
+        void *p = mmap(nullptr, header.fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(p == MAP_FAILED){
+            shm_unlink(name.c_str());
+            ::close(fd);
+            cerr << "failed to map shared memory " << name << "." << endl; return -1;
+        }
+        // ftruncate 直後は全て 0 なので ready も立っていない
+        // 中身とヘッダを書き終えてから ready を release で立てる
+        char *const base = static_cast<char*>(p);
+        for(std::size_t i = 0; i < sh.size(); ++i){
+            memcpy(base + sh[i].offset, src[i].data, sh[i].size());
+        }
+        memcpy(base + sizeof(TableFileHeader), sh.data(), sizeof(TableSectionHeader) * sh.size());
+        TableFileHeader *const ph = reinterpret_cast<TableFileHeader*>(base);
+        TableFileHeader tmp = header;
+        tmp.ready = 0;
+        memcpy(ph, &tmp, sizeof(tmp));
+        __atomic_store_n(&ph->ready, TABLE_READY, __ATOMIC_RELEASE);
+        munmap(p, header.fileSize);
+        ::close(fd); // flock も外れる
+        return 0;
+    }
+
+    /**************************読み込み**************************/
+
+    class MappedTableFile{
+        // 読み込み専用で mmap したテーブルファイル
+        // プロセス終了まで保持する前提
+    public:
+        int open(const std::string& path){
+            close();
+            int fd = ::open(path.c_str(), O_RDONLY);
+            if(fd < 0){
+                cerr << "failed to open " << path << "." << endl; return -1;
+            }
+            return map(fd, path);
+        }
+        int openShared(const std::string& name, int waitMs = SHARED_TABLE_WAIT_MS){
+            // 共有メモリのテーブルに attach する
+            // 他のプロセスが作成中なら ready が立つまで最大 waitMs 待つ
+            // 古いものを消した場合は SHARED_TABLE_REMOVED
+            close();
+            int fd = shm_open(name.c_str(), O_RDONLY, 0);
+            if(fd < 0){ return -1; } // 未作成
+            using clock_t = std::chrono::steady_clock;
+            const auto start = clock_t::now();
+            auto unlockedSince = start;
+            bool unlocked = false; // 前回の確認で flock が外れていたか
+            struct stat st;
+            while(true){
+                if(fstat(fd, &st) < 0){
+                    ::close(fd);
+                    cerr << "failed to stat " << name << "." << endl; return -1;
+                }
+                if(st.st_nlink == 0){ // 待っている間に他のプロセスが消した
+                    ::close(fd);
+                    return SHARED_TABLE_REMOVED;
+                }
+                // 大きさは ftruncate で一度に決まるので、0 でなければ最終的な大きさ
+                bool ours = true; // 作成途中か、この形式の magic を持つ
+                if((uint64_t)st.st_size >= sizeof(TableFileHeader)){
+                    const TableFileHeader *const ph = static_cast<const TableFileHeader*>(
+                        mmap(nullptr, sizeof(TableFileHeader), PROT_READ, MAP_SHARED, fd, 0));
+                    if(ph == MAP_FAILED){
+                        ::close(fd);
+                        cerr << "failed to map " << name << "." << endl; return -1;
+                    }
+                    static const char zeros[sizeof(ph->magic)] = {0};
+                    const bool magic = memcmp(ph->magic, TABLE_FILE_MAGIC, sizeof(ph->magic)) == 0;
+                    const bool ready = loadTableReady(ph) == TABLE_READY;
+                    const uint32_t version = ph->version;
+                    const bool oldVersion = magic && version != TABLE_FILE_VERSION;
+                    ours = magic || memcmp(ph->magic, zeros, sizeof(ph->magic)) == 0;
+                    munmap(const_cast<TableFileHeader*>(ph), sizeof(TableFileHeader));
+                    if(oldVersion){ // 別の版の形式で書き終えたもの(ready の位置が違う)
+                        cerr << "shared tables " << name << " have version " << version << "." << endl;
+                        ::close(fd);
+                        removeStaleSharedTable(name, st);
+                        return SHARED_TABLE_REMOVED;
+                    }
+                    if(ready){ break; }
+                    if(!ours){ // テーブル以外のものは待たず、消しもしない
+                        ::close(fd);
+                        cerr << name << " is not a table." << endl; return -1;
+                    }
+                }
+                // 作成したプロセスが落ちていれば flock が取れる
+                if(flock(fd, LOCK_EX | LOCK_NB) == 0){
+                    flock(fd, LOCK_UN);
+                    const auto now = clock_t::now();
+                    if(!unlocked){
+                        unlocked = true;
+                        unlockedSince = now;
+                    }else if(now - unlockedSince >= std::chrono::milliseconds(SHARED_TABLE_ABANDON_MS)){
+                        cerr << "shared tables " << name << " were abandoned while being written." << endl;
+                        ::close(fd);
+                        removeStaleSharedTable(name, st);
+                        return SHARED_TABLE_REMOVED;
+                    }
+                }else{
+                    unlocked = false;
+                }
+                if(clock_t::now() - start >= std::chrono::milliseconds(waitMs)){
+                    ::close(fd);
+                    cerr << name << " is not ready in " << waitMs << " ms." << endl; return -1;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            const int ret = map(fd, name);
+            if(ret == INVALID_TABLE){ // 書き終えているのに検証で弾かれた
+                removeStaleSharedTable(name, st);
+                return SHARED_TABLE_REMOVED;
+            }
+            return ret;
+        }
+        void close(){
+            if(base_ != nullptr){
+                munmap(const_cast<char*>(base_), size_);
+            }
+            base_ = nullptr;
+            size_ = 0;
+        }
+
+        const TableFileHeader& header()const{
+            return *reinterpret_cast<const TableFileHeader*>(base_);
+        }
+        const TableSectionHeader *sectionHeader(uint32_t id)const{
+            const TableSectionHeader *const psh = sectionHeaders();
+            for(uint32_t i = 0; i < header().sections; ++i){
+                if(psh[i].id == id){ return psh + i; }
+            }
+            return nullptr;
+        }
+        template<class T>
+        const T *section(uint32_t id, uint64_t elements)const{
+            // 要素の大きさと数が一致しなければ nullptr
+            const TableSectionHeader *const psh = sectionHeader(id);
+            if(psh == nullptr || psh->elementSize != sizeof(T) || psh->elements != elements){
+                return nullptr;
+            }
+            return reinterpret_cast<const T*>(base_ + psh->offset);
+        }
+        bool isOpen()const noexcept{ return base_ != nullptr; }
+
+        ~MappedTableFile(){ close(); }
+
+    private:
+        static constexpr int INVALID_TABLE = -2; // map() で検証に失敗した
+
+        const char *base_ = nullptr;
+        uint64_t size_ = 0;
+
+        int map(int fd, const std::string& name){
+            // fd はここで閉じる
+            struct stat st;
+            if(fstat(fd, &st) < 0 || (uint64_t)st.st_size < sizeof(TableFileHeader)){
+                ::close(fd);
+                cerr << name << " is too small." << endl; return -1;
+            }
+            void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if(p == MAP_FAILED){
+                cerr << "failed to map " << name << "." << endl; return -1;
+            }
+            base_ = static_cast<const char*>(p);
+            size_ = st.st_size;
+            if(validate() < 0){
+                cerr << name << " is not a valid table file." << endl;
+                close();
+                return INVALID_TABLE;
+            }
+            return 0;
+        }
+
+        const TableSectionHeader *sectionHeaders()const{
+            return reinterpret_cast<const TableSectionHeader*>(base_ + sizeof(TableFileHeader));
+        }
+        int validate()const{
+            const TableFileHeader& h = header();
+            if(memcmp(h.magic, TABLE_FILE_MAGIC, sizeof(h.magic)) != 0){ return -1; }
+            if(h.version != TABLE_FILE_VERSION){
+                cerr << "table file version " << h.version << " <-> " << TABLE_FILE_VERSION << endl;
+                return -1;
+            }
+            if(loadTableReady(&h) != TABLE_READY){ return -1; } // 書き込み途中
+            if(h.fileSize != size_ || h.sections == 0 || h.sections > N_MAX_TABLE_SECTIONS){ return -1; }
+            if(sizeof(TableFileHeader) + sizeof(TableSectionHeader) * h.sections > size_){ return -1; }
+            const TableSectionHeader *const psh = sectionHeaders();
+            if(calcHeaderChecksum(psh, h.sections) != h.checksum){ return -1; }
+            for(uint32_t i = 0; i < h.sections; ++i){
+                if(psh[i].offset % TABLE_SECTION_ALIGNMENT != 0
+                   || psh[i].offset + psh[i].size() > size_){ return -1; }
+                if(calcTableChecksum(base_ + psh[i].offset, psh[i].size()) != psh[i].checksum){
+                    cerr << "checksum mismatch in table section " << psh[i].id << "." << endl;
+                    return -1;
+                }
+            }
+            return 0;
+        }
+    };
+}
+
+#endif // MAHJONG_STRUCTURE_TABLEFILE_HPP_
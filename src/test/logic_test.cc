@@ -5,12 +5,51 @@
 
 // 麻雀応用演算のテスト
 
+#include <cfloat>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+
 #include "../mahjong.hpp"
 
 using namespace Mahjong;
 
 Clock cl;
 
+struct PerfCounter{
+    // perf_event_open によるハードウェアカウンタ
+    // 権限が無い環境では available() が false
+    int fd;
+    
+    PerfCounter(uint32_t type, uint64_t config){
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    ~PerfCounter(){
+        if(fd >= 0){ close(fd); }
+    }
+    bool available()const{ return fd >= 0; }
+    void start(){
+        if(fd < 0){ return; }
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    uint64_t stop(){
+        if(fd < 0){ return 0; }
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        uint64_t cnt = 0;
+        if(read(fd, &cnt, sizeof(cnt)) != sizeof(cnt)){ return 0; }
+        return cnt;
+    }
+};
+
 template<class dice_t>
 int testDealNaive1P(const std::vector<PieceSet>& samples, dice_t *const pdice){
     uint64_t clSum[4] = {0};
@@ -62,8 +101,8 @@ int testDealExt1P(const std::vector<ExtPieceSet>& samples, dice_t *const pdice){
 
 int testMinimumSteps(const std::vector<Hand>& samples){
     // シャンテン数と受け入れ牌の計算
-    uint64_t clSum[2] = {0};
-    std::vector<uint64_t> clv[2];
+    uint64_t clSum[3] = {0};
+    std::vector<uint64_t> clv[3];
     for(auto& v : clv){
         v.reserve(samples.size());
     }
@@ -73,7 +112,7 @@ int testMinimumSteps(const std::vector<Hand>& samples){
     for(const Hand& hand : samples){
         PieceExistance acceptable;
         cl.start();
-        int ms = calcMinimumSteps(hand, &acceptable);
+        int ms = calcNormalMinimumSteps(hand, &acceptable);
         uint64_t tm = cl.stop();
         clv[0].push_back(tm);
         clSum[0] += tm;
@@ -99,11 +138,68 @@ int testMinimumSteps(const std::vector<Hand>& samples){
         msSum[1] += ms;
         acSum[1] += acceptable;
     }
+    for(const Hand& hand : samples){ // 七対子と国士無双込み
+        PieceExistance acceptable, normalAcceptable;
+        cl.start();
+        int ms = calcMinimumSteps(hand, &acceptable);
+        uint64_t tm = cl.stop();
+        clv[2].push_back(tm);
+        clSum[2] += tm;
+        int nms = calcNormalMinimumSteps(hand, &normalAcceptable);
+        if(ms > nms || (ms == nms && (normalAcceptable & ~acceptable))){
+            cerr << "failed to merge special forms." << endl;
+            return -1;
+        }
+    }
+    {
+        // 組み合わせを表で求める場合と、分岐しながら全探索する場合
+        uint64_t clTable = 0, clLoop = 0;
+        for(const Hand& hand : samples){
+            PieceExistance acTable, acLoop;
+            cl.start();
+            int msTable = calcNormalMinimumSteps(hand, &acTable);
+            clTable += cl.stop();
+            cl.start();
+            int msLoop = calcNormalMinimumStepsLoop(hand, &acLoop);
+            clLoop += cl.stop();
+            if(msTable != msLoop || acTable != acLoop){
+                cerr << "combination table differs from loop." << endl;
+                return -1;
+            }
+        }
+        cerr << "combination table  : " << clTable / samples.size() << " clock" << endl;
+        cerr << "combination loop   : " << clLoop / samples.size() << " clock (x" << double(clLoop) / max(clTable, (uint64_t)1) << ")" << endl;
+    }
+    {
+        // 1つずつ計算する場合と、次の手牌のテーブルを先読みしながらまとめて計算する場合
+        const int n = samples.size();
+        std::vector<int> msv[2];
+        std::vector<PieceExistance> acv[2];
+        for(int i = 0; i < 2; ++i){
+            msv[i].resize(n);
+            acv[i].resize(n);
+        }
+        cl.start();
+        for(int k = 0; k < n; ++k){
+            msv[0][k] = calcMinimumSteps(samples[k], &acv[0][k]);
+        }
+        uint64_t clSingle = cl.stop();
+        cl.start();
+        calcMinimumStepsBatch(samples.data(), n, msv[1].data(), acv[1].data());
+        uint64_t clBatch = cl.stop();
+        cerr << "minumum steps loop : " << clSingle / n << " clock" << endl;
+        cerr << "minumum steps batch: " << clBatch / n << " clock (x" << double(clSingle) / max(clBatch, (uint64_t)1) << ")" << endl;
+        if(msv[0] != msv[1] || acv[0] != acv[1]){
+            cerr << "batched calculation differs." << endl;
+            return -1;
+        }
+    }
     for(auto& v : clv){
         std::sort(v.begin(), v.end());
     }
     cerr << "minumum steps test : " << clSum[0] / samples.size() << " clock (mid " << clv[0][samples.size() / 2] << ")" << endl;
     cerr << "minumum steps ans  : " << clSum[1] / samples.size() << " clock (mid " << clv[1][samples.size() / 2] << ")" << endl;
+    cerr << "minumum steps all  : " << clSum[2] / samples.size() << " clock (mid " << clv[2][samples.size() / 2] << ")" << endl;
     if(msSum[0] != msSum[1]){
         cerr << "failed to calculate minimum steps." << endl;
         return -1;
@@ -115,8 +211,75 @@ int testMinimumSteps(const std::vector<Hand>& samples){
     return 0;
 }
 
+int testTableTLB(const std::vector<Hand>& samples){
+    // テーブルの置き場所ごとの calcMinimumSteps の速度と dTLB ミス
+    const char *pageTypeName[] = {"normal pages", "hugetlb pages", "transparent huge pages"};
+    // 交互に何度か測り、ページの種類ごとに最速の回を比べる
+    constexpr int N_REPEATS = 20;
+    constexpr int N_ROUNDS = 5;
+    waitStepsTables();
+    int msSum[2] = {0};
+    double bestNs[2] = {DBL_MAX, DBL_MAX};
+    TablePageType pageType[2] = {PAGE_NORMAL, PAGE_NORMAL};
+    for(int round = 0; round < N_ROUNDS * 2; ++round){
+        const int huge = round % 2;
+        if(copyStepsTables(huge) < 0){
+            cerr << "failed to prepare tables." << endl;
+            return -1;
+        }
+        PerfCounter dtlb(PERF_TYPE_HW_CACHE,
+                         PERF_COUNT_HW_CACHE_DTLB
+                         | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                         | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+        PieceExistance acceptable;
+        for(const Hand& hand : samples){ // 初回のページフォールトを除く
+            msSum[huge] += calcMinimumSteps(hand, &acceptable);
+        }
+        msSum[huge] = 0;
+        dtlb.start();
+        auto start = std::chrono::steady_clock::now();
+        for(int i = 0; i < N_REPEATS; ++i){
+            for(const Hand& hand : samples){
+                msSum[huge] += calcMinimumSteps(hand, &acceptable);
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+        uint64_t misses = dtlb.stop();
+        const double calls = double(samples.size()) * N_REPEATS;
+        const double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+        cerr << "tables on " << pageTypeName[stepsTablesPageType] << " : " << ns / calls << " ns/call";
+        if(dtlb.available()){
+            cerr << ", " << misses / calls << " dTLB misses/call";
+        }else{
+            cerr << ", dTLB counter unavailable";
+        }
+        cerr << endl;
+        bestNs[huge] = std::min(bestNs[huge], ns / calls);
+        pageType[huge] = stepsTablesPageType;
+    }
+    cerr << "best of " << N_ROUNDS << " : " << pageTypeName[pageType[0]] << " " << bestNs[0] << " ns/call, ";
+    cerr << pageTypeName[pageType[1]] << " " << bestNs[1] << " ns/call" << endl;
+    if(msSum[0] != msSum[1]){
+        cerr << "tables differ after copy." << endl;
+        return -1;
+    }
+    return 0;
+}
+
 int main(int argc, char* argv[]){
     
+    bool tlbMode = false;
+    for(int c = 1; c < argc; ++c){
+        if(!strcmp(argv[c], "-tlb")){ // ヒュージページの効果測定
+            tlbMode = true;
+        }
+    }
+    
+    // 比較用の水上さんのテーブル
+    if(!tlbMode && (initShantenTable() < 0 || initAcceptableTable() < 0)){
+        return -1;
+    }
+    
     std::vector<PieceSet4> randomPs;
     std::vector<ExtPieceSet4> randomEps;
     std::vector<Hand> randomHand;
@@ -148,6 +311,10 @@ int main(int argc, char* argv[]){
         randomHand.push_back(hand);
     }
     
+    if(tlbMode){
+        return testTableTLB(randomHand);
+    }
+    
     testMinimumSteps(randomHand);
     testDealNaive1P(randomPs, &dice);
     testDealExt1P(randomEps, &dice);
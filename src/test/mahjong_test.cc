@@ -416,6 +416,290 @@ int testNR(const std::vector<Cards>& sample){
     return 0;
 }
 */
+void dealRandomWall(Wall *const pwall, XorShift64 *const pdice){
+    // ランダムな山を作る
+    ExtPieceSet filled;
+    filled.fill();
+    BitArray32<8, N_PIECE_TYPES> typeSum = TYPE_SUM_ALL;
+    int sum = N_ALL_PIECES;
+    for(int i = 0; i < N_WALL_PIECES; ++i){
+        ExtPiece ep = dealExtPiece(filled, typeSum, sum, pdice);
+        (*pwall)[i] = ep;
+        filled -= ep;
+        typeSum.subtr(toPieceType(ep), 1);
+        sum -= 1;
+    }
+}
+
+void initGameByWall(Field *const pfield, const Wall& wall){
+    // 山の並び通りに配牌して局を開始する(全員の手牌が見える客観的な盤面)
+    std::array<Score, N_PLAYERS> initialScore;
+    initialScore.fill(SCORE_INITIAL);
+    std::array<ExtPieceSet, N_PLAYERS> dealt;
+    std::array<int, N_PLAYERS> pieces;
+    for(Player pn = 0; pn < N_PLAYERS; ++pn){
+        dealt[pn].clear();
+        for(int j = 0; j < N_DEALT_PIECES; ++j){
+            dealt[pn] += wall[j * N_PLAYERS + pn];
+        }
+        pieces[pn] = N_DEALT_PIECES;
+    }
+    pfield->initMatch(SINGLE, NONE_PLAYER, initialScore);
+    pfield->initGame(WIND_E, 0, 0, 0, 0, wall[wallIndexDoraMarker(0)], dealt, pieces);
+}
+
+template<class field_t, class callback_t>
+int playRandomGame(field_t *const pfield, const Wall& wall, XorShift64 *const pdice,
+                   const callback_t& check){
+    // 山の最後までランダムに打ち、途中で check を呼ぶ
+    // 捨て牌を2枚持っているプレーヤーがいればポンすることがある
+    auto randomPiece = [pfield, pdice](Player pn)->ExtPiece{
+        const int k = pdice->rand() % pfield->hand[pn].piece.sum();
+        ExtPiece ret = EXT_PIECE_NONE;
+        iterateExtPieceWithCount(pfield->hand[pn].piece, [k, &ret](int index, ExtPiece ep)->void{
+            if(index == k){ ret = ep; }
+        });
+        return ret;
+    };
+    
+    if(check("start")){ return -1; }
+    while(pfield->turn < N_TURNS){
+        const Player tp = pfield->turnPlayer;
+        const ExtPiece drawn = wall[wallIndexTurn(pfield->turn)];
+        pfield->setTurn(tp, drawn);
+        if(check("setTurn")){ return -1; }
+        
+        if(pfield->isInReach(tp)){
+            pfield->discard(tp, drawn, true);
+        }else{
+            pfield->discard(tp, randomPiece(tp), false);
+            // reachTurn は打牌の前の手数なので、最初の手番のリーチはリーチ中と区別できない
+            if(pfield->turn > 0 && pdice->rand() % 16 == 0){
+                pfield->reach(tp);
+            }
+        }
+        if(check("discard")){ return -1; }
+        
+        if(pfield->doras < N_MAX_DORAS && pdice->rand() % 16 == 0){
+            pfield->pushDora(wall[wallIndexDoraMarker(pfield->doras)]);
+            if(check("pushDora")){ return -1; }
+        }
+        
+        const ExtPiece discarded = pfield->lastDiscarded(tp);
+        const Piece p = toPiece(discarded);
+        Player ponged = NONE_PLAYER;
+        if(toRank(p) != RANK_RED && pdice->rand() % 2 == 0){
+            for(Player q = nextPlayer(tp); q != tp; q = nextPlayer(q)){
+                if(!pfield->isInReach(q) && pfield->hand[q].piece[p] >= N_PONG_PIECES - 1){
+                    ponged = q; break;
+                }
+            }
+        }
+        if(ponged != NONE_PLAYER){
+            ExtPieceSet opened;
+            opened.clear();
+            opened.add(p, N_PONG_PIECES - 1);
+            pfield->pong(ponged, toGroupMeld(p, N_PONG_PIECES, false), discarded, opened);
+            if(check("pong")){ return -1; }
+            pfield->discard(ponged, randomPiece(ponged), false);
+            if(check("discard after pong")){ return -1; }
+            pfield->procTurn(nextPlayer(ponged));
+        }else{
+            pfield->procTurn();
+        }
+        if(check("procTurn")){ return -1; }
+    }
+    return 0;
+}
+
+int testFieldHash(XorShift64 *const pdice){
+    // 盤面ハッシュ値の差分更新が盤面からの再計算と一致するか
+    for(int g = 0; g < 1000; ++g){
+        Wall wall;
+        dealRandomWall(&wall, pdice);
+        Field field;
+        initGameByWall(&field, wall);
+        
+        auto check = [&field](const char *const str)->int{
+            const uint64_t key = field.calcHashKey();
+            if(field.hashKey != key){
+                cerr << "inconsistent field hash key after " << str << endl;
+                cerr << field.hashKey << " <-> " << key << endl;
+                return -1;
+            }
+            SimField sfield;
+            sfield.setFrom(field);
+            if(sfield.hashKey != sfield.calcHashKey()){
+                cerr << "inconsistent field hash key of SimField after " << str << endl;
+                return -1;
+            }
+            return 0;
+        };
+        if(playRandomGame(&field, wall, pdice, check)){ return -1; }
+    }
+    return 0;
+}
+        
+int testFieldJournal(XorShift64 *const pdice){
+    // 巻き戻し付き盤面でのプレイアウトと盤面コピーでのプレイアウトの比較
+    constexpr int N_PLAYOUTS = 16; // 1つの世界でのプレイアウト回数
+    uint64_t clSum[2] = {0};
+    auto noCheck = [](const char *const)->int{ return 0; };
+    for(int g = 0; g < 1000; ++g){
+        Wall wall;
+        dealRandomWall(&wall, pdice);
+        Field field;
+        initGameByWall(&field, wall);
+        // 途中局面を根にする
+        const int rootTurn = pdice->rand() % (N_TURNS / 2);
+        while(field.turn < rootTurn){
+            const Player tp = field.turnPlayer;
+            const ExtPiece drawn = wall[wallIndexTurn(field.turn)];
+            field.setTurn(tp, drawn);
+            field.discard(tp, drawn, true);
+            field.procTurn();
+        }
+        SimField root;
+        root.setFrom(field);
+        const std::string rootString = root.toDebugString();
+            
+        JournaledSimField jfield;
+        jfield.setRoot(root);
+        for(int i = 0; i < N_PLAYOUTS; ++i){
+            // 同じ乱数列で同じ試合を打つ
+            XorShift64 dice0 = *pdice, dice1 = *pdice;
+            
+            cl.start();
+            SimField tfield = root;
+            clSum[0] += cl.stop();
+            playRandomGame(&tfield, wall, &dice0, noCheck);
+            
+            playRandomGame(&jfield, wall, &dice1, noCheck);
+            if(jfield.hashKey != tfield.hashKey){
+                cerr << "inconsistent playout on journaled field" << endl;
+                return -1;
+            }
+            cl.start();
+            jfield.rollback(root);
+            clSum[1] += cl.stop();
+            
+            if(jfield.hashKey != root.hashKey
+               || jfield.toDebugString() != rootString){
+                cerr << "failed to roll back journaled field" << endl;
+                cerr << jfield.toDebugString() << endl;
+                cerr << rootString << endl;
+                return -1;
+            }
+            *pdice = dice0;
+        }
+    }
+    cerr << "field copy     : " << clSum[0] / (1000 * N_PLAYOUTS) << " clock" << endl;
+    cerr << "field rollback : " << clSum[1] / (1000 * N_PLAYOUTS) << " clock" << endl;
+    return 0;
+}
+
+int testWinScoreConcealedKong(){
+    // 暗槓を暗刻として数え、暗槓の符を付けるか
+    // 9索の暗槓 + 2萬 6筒の暗刻 + 345索 + 8筒の雀頭 (5索ロン、両面待ち)
+    // 3枚目の暗刻になるので三暗刻、符は 20 + 10(門前ロン) + 4 + 4 + 32(么九牌の暗槓) = 70
+    // 345索を7萬の暗刻に替えて8筒単騎でロンすると四暗刻単騎
+    const Piece kong = toPiece(BAMBOO, RANK_9);
+    Hand hand;
+    auto setHand = [&hand, kong](const ExtPieceSet& rest)->void{
+        ExtPieceSet eps = rest;
+        eps.add(toPiece(CHARACTER, RANK_2), N_PONG_PIECES);
+        eps.add(toPiece(CIRCLE, RANK_6), N_PONG_PIECES);
+        eps.add(toPiece(CIRCLE, RANK_8), 2);
+        hand.clear();
+        hand.setAll(eps);
+        hand.addOpenedGroupNoPick(toGroupMeld(kong, N_KONG_PIECES, false));
+    };
+    WinContext wc;
+    wc.drawWin = false;
+    wc.ownWind = toWindPiece(WIND_S);
+    wc.fieldWind = toWindPiece(WIND_E);
+    
+    ExtPieceSet rest;
+    rest.clear();
+    rest.add(toPiece(BAMBOO, RANK_3), 1);
+    rest.add(toPiece(BAMBOO, RANK_4), 1);
+    rest.add(toPiece(BAMBOO, RANK_5), 1);
+    setHand(rest);
+    wc.winning = toPiece(BAMBOO, RANK_5);
+    wc.concealed = hand.isConcealed();
+    if(!hand.exam() || !wc.concealed){
+        cerr << "invalid hand with concealed kong" << endl << hand.toDebugString() << endl;
+        return -1;
+    }
+    // シミュレーション用の手牌を経由しても暗槓が残るか
+    SimHand simHand;
+    Hand simToHand;
+    simHand.set(hand);
+    simHand.toHand(&simToHand);
+    const WinScore ws[2] = {evalWinScore(hand, wc), evalWinScore(simToHand, wc)};
+    for(const WinScore& s : ws){
+        if(!s.status.test(THREE_CONCEALED_TRIPLES) || s.fu != 70){
+            cerr << "wrong score with concealed kong " << hand.piece << endl;
+            cerr << "three concealed triples = " << s.status.test(THREE_CONCEALED_TRIPLES)
+            << " fu = " << s.fu << endl;
+            return -1;
+        }
+    }
+    
+    rest.clear();
+    rest.add(toPiece(CHARACTER, RANK_7), N_PONG_PIECES);
+    setHand(rest);
+    wc.winning = toPiece(CIRCLE, RANK_8);
+    const WinScore fws = evalWinScore(hand, wc);
+    if(!fws.status.test(ALL_CONCEALED_TRIPLES_HEAD) || fws.fullBonus != 2){
+        cerr << "wrong score with concealed kong " << hand.piece << endl;
+        cerr << "all concealed triples = " << fws.status.test(ALL_CONCEALED_TRIPLES_HEAD)
+        << " full bonus = " << fws.fullBonus << endl;
+        return -1;
+    }
+    return 0;
+}
+
+int testWinScoreAllDoubles(){
+    // 七対子は全ての牌が0枚か2枚のときだけ
+    // 11 33萬 55 77筒 22 99索 東東 (東単騎ロン) と、33萬の1枚を1萬に替えた上がっていない形
+    auto makeHand = [](Piece odd)->Hand{
+        ExtPieceSet eps;
+        eps.clear();
+        eps.add(toPiece(CHARACTER, RANK_1), 2);
+        eps.add(toPiece(CHARACTER, RANK_3), 1);
+        eps.add(odd, 1);
+        eps.add(toPiece(CIRCLE, RANK_5), 2);
+        eps.add(toPiece(CIRCLE, RANK_7), 2);
+        eps.add(toPiece(BAMBOO, RANK_2), 2);
+        eps.add(toPiece(BAMBOO, RANK_9), 2);
+        eps.add(toWindPiece(WIND_E), 2);
+        Hand hand;
+        hand.clear();
+        hand.setAll(eps);
+        return hand;
+    };
+    WinContext wc;
+    wc.winning = toWindPiece(WIND_E);
+    wc.drawWin = false;
+    wc.concealed = true;
+    wc.ownWind = toWindPiece(WIND_S);
+    wc.fieldWind = toWindPiece(WIND_E);
+    
+    const Hand hand = makeHand(toPiece(CHARACTER, RANK_3));
+    const WinScore ws = evalWinScore(hand, wc);
+    if(!ws.status.test(ALL_DOUBLES) || ws.fu != 25){
+        cerr << "seven pairs not found " << hand.piece << endl;
+        return -1;
+    }
+    const Hand noWin = makeHand(toPiece(CHARACTER, RANK_1));
+    if(evalWinScore(noWin, wc).isWin()){
+        cerr << "wrong seven pairs " << noWin.piece << endl;
+        return -1;
+    }
+    return 0;
+}
+
 int outputStructureSize(){
     cerr << "sizeof Player           = " << sizeof(Player) << endl;
     cerr << "sizeof MatchType        = " << sizeof(MatchType) << endl;
@@ -439,9 +723,11 @@ int outputStructureSize(){
     cerr << "sizeof PieceSet4        = " << sizeof(PieceSet4) << endl;
     cerr << "sizeof ExtPieceSet4     = " << sizeof(ExtPieceSet4) << endl;
     cerr << "sizeof Hand             = " << sizeof(Hand) << endl;
+    cerr << "sizeof SimHand          = " << sizeof(SimHand) << endl;
     cerr << "sizeof Wall             = " << sizeof(Wall) << endl;
     cerr << "sizeof World            = " << sizeof(World) << endl;
     cerr << "sizeof Field            = " << sizeof(Field) << endl;
+    cerr << "sizeof SimField         = " << sizeof(SimField) << endl;
     cerr << "sizeof TurnRecord       = " << sizeof(TurnRecord) << endl;
     cerr << "sizeof GameRecord       = " << sizeof(GameRecord) << endl;
     cerr << "sizeof MatchRecord      = " << sizeof(MatchRecord) << endl;
@@ -576,6 +862,30 @@ int main(int argc, char* argv[]){
         return -1;
     }
     cerr << "passed SC test." << endl << endl;
+    
+    if(testFieldHash(&dice)){
+        cerr << "failed field hash test." << endl;
+        return -1;
+    }
+    cerr << "passed field hash test." << endl << endl;
+    
+    if(testFieldJournal(&dice)){
+        cerr << "failed field journal test." << endl;
+        return -1;
+    }
+    cerr << "passed field journal test." << endl << endl;
+    
+    if(testWinScoreConcealedKong()){
+        cerr << "failed concealed kong score test." << endl;
+        return -1;
+    }
+    cerr << "passed concealed kong score test." << endl << endl;
+    
+    if(testWinScoreAllDoubles()){
+        cerr << "failed seven pairs score test." << endl;
+        return -1;
+    }
+    cerr << "passed seven pairs score test." << endl << endl;
     /*
     if(testNR(sample)){
         cerr << "failed NR test." << endl;
@@ -0,0 +1,331 @@
+/*
+ shanten_test.cc
+ Katsuki Ohto
+ */
+
+// シャンテン数計算の全探索との照合と速度計測
+// 表や SIMD で書き換える前後で必ず通すこと
+
+#include "../mahjong.hpp"
+
+using namespace Mahjong;
+
+std::vector<Piece> allPieces; // 34種類
+
+/**************************全探索による正解**************************/
+
+struct StepsOracle{
+    // 手牌を面子、塔子、雀頭、孤立牌に分ける全ての方法を試す
+    int count[PIECE_MAX + 1];
+    int opened;
+    int bestValue;
+
+    void search(int i, int melds, int tarts, int heads){
+        while(i < (int)allPieces.size() && count[allPieces[i]] == 0){ ++i; }
+        if(i == (int)allPieces.size()){
+            const int m = melds + opened;
+            const int value = min(2 * m + tarts, m + 4) + heads; // 塔子は面子と合わせて4つまで
+            bestValue = max(bestValue, value);
+            return;
+        }
+        const Piece p = allPieces[i];
+        const bool seq = !isHonor(p);
+        const Rank r = toRank(p);
+        count[p] -= 1; search(i, melds, tarts, heads); count[p] += 1; // 孤立牌
+        if(count[p] >= 2){
+            count[p] -= 2;
+            search(i, melds, tarts + 1, heads);
+            if(heads == 0){ search(i, melds, tarts, 1); }
+            count[p] += 2;
+        }
+        if(count[p] >= 3){
+            count[p] -= 3; search(i, melds + 1, tarts, heads); count[p] += 3;
+        }
+        if(seq && r + 2 <= RANK_MAX && count[p + 1] && count[p + 2]){
+            count[p] -= 1; count[p + 1] -= 1; count[p + 2] -= 1;
+            search(i, melds + 1, tarts, heads);
+            count[p] += 1; count[p + 1] += 1; count[p + 2] += 1;
+        }
+        if(seq && r + 1 <= RANK_MAX && count[p + 1]){
+            count[p] -= 1; count[p + 1] -= 1;
+            search(i, melds, tarts + 1, heads);
+            count[p] += 1; count[p + 1] += 1;
+        }
+        if(seq && r + 2 <= RANK_MAX && count[p + 2]){
+            count[p] -= 1; count[p + 2] -= 1;
+            search(i, melds, tarts + 1, heads);
+            count[p] += 1; count[p + 2] += 1;
+        }
+    }
+    int normal(){
+        bestValue = -N_DEALT_PIECES;
+        search(0, 0, 0, 0);
+        return 2 * 4 - bestValue;
+    }
+    int sevenPairs()const{
+        int kinds = 0, pairs = 0;
+        for(Piece p : allPieces){
+            kinds += count[p] >= 1;
+            pairs += count[p] >= 2;
+        }
+        return 6 - pairs + max(0, 7 - kinds);
+    }
+    int thirteenOrphans()const{
+        int kinds = 0;
+        bool pair = false;
+        for(Piece p : allPieces){
+            if(isHonor(p) || toRank(p) == RANK_MIN || toRank(p) == RANK_MAX){
+                kinds += count[p] >= 1;
+                pair |= count[p] >= 2;
+            }
+        }
+        return 13 - kinds - (pair ? 1 : 0);
+    }
+    int steps(bool special){
+        int s = normal();
+        if(special && opened == 0){
+            s = min(s, min(sevenPairs(), thirteenOrphans()));
+        }
+        return s;
+    }
+    int steps(bool special, PieceExistance *const pac){
+        // 受け入れ牌は1枚加えるとシャンテン数が下がる牌
+        const int s = steps(special);
+        pac->reset();
+        for(Piece p : allPieces){
+            if(count[p] >= N_ONE_PIECE){ continue; }
+            count[p] += 1;
+            if(steps(special) < s){ pac->set(p); }
+            count[p] -= 1;
+        }
+        return s;
+    }
+};
+
+/**************************テスト用の手牌**************************/
+
+enum HandCategory{
+    CATEGORY_CONCEALED_13, CATEGORY_CONCEALED_14, CATEGORY_OPENED,
+    CATEGORY_HONORS, CATEGORY_SEVEN_PAIRS, N_CATEGORIES
+};
+const char *categoryName[N_CATEGORIES] = {
+    "13 concealed", "14 concealed", "opened melds", "honors heavy", "seven pairs"
+};
+
+struct TestHand{
+    Hand hand;
+    int count[PIECE_MAX + 1]; // 門前部分の枚数
+    int opened;
+    PieceExistance answerAcceptable[2]; // 一般形のみ, 七対子と国士無双込み
+    int answerSteps[2];
+    bool checkAcceptable; // 3n+1枚のときだけ受け入れ牌を比べる
+};
+
+template<class dice_t>
+Piece pickPiece(const int *used, bool honor, dice_t *const pdice){
+    while(true){
+        Piece p;
+        if(honor){
+            p = toPiece(HONOR, static_cast<Rank>(pdice->rand() % N_HONORS));
+        }else{
+            p = allPieces[pdice->rand() % allPieces.size()];
+        }
+        if(used[p] < N_ONE_PIECE){ return p; }
+    }
+}
+
+template<class dice_t>
+void dealTestHand(int category, dice_t *const pdice, TestHand *const pth){
+    int used[PIECE_MAX + 1] = {0};
+    int n = N_DEALT_PIECES;
+    std::vector<Meld> melds;
+
+    switch(category){
+        case CATEGORY_CONCEALED_14: n += 1; break;
+        case CATEGORY_OPENED:{
+            const int k = 1 + pdice->rand() % (N_DEALT_PIECES / 3);
+            while((int)melds.size() < k){
+                const Piece p = pickPiece(used, false, pdice);
+                if(!isHonor(p) && toRank(p) + 2 <= RANK_MAX && pdice->rand() % 2
+                   && used[p + 1] < N_ONE_PIECE && used[p + 2] < N_ONE_PIECE){
+                    used[p] += 1; used[p + 1] += 1; used[p + 2] += 1;
+                    melds.push_back(toSeqMeld(p, N_CHOW_PIECES, false));
+                }else if(used[p] == 0){
+                    used[p] += N_PONG_PIECES;
+                    melds.push_back(toGroupMeld(p, N_PONG_PIECES, false));
+                }
+            }
+            n = N_DEALT_PIECES - N_PONG_PIECES * k + pdice->rand() % 2;
+        }break;
+        case CATEGORY_SEVEN_PAIRS:{
+            const int pairs = 4 + pdice->rand() % 3;
+            for(int i = 0; i < pairs; ++i){
+                Piece p;
+                do{
+                    p = pickPiece(used, false, pdice);
+                }while(used[p] != 0);
+                used[p] += 2;
+            }
+            n -= 2 * pairs;
+        }break;
+        default: break;
+    }
+    for(int i = 0; i < n; ++i){
+        const bool honor = category == CATEGORY_HONORS && pdice->rand() % 2;
+        used[pickPiece(used, honor, pdice)] += 1;
+    }
+
+    // 鳴いた牌を除いたものが門前部分
+    for(Piece p : allPieces){ pth->count[p] = used[p]; }
+    for(Meld m : melds){
+        if(m.chow()){
+            for(int i = 0; i < N_CHOW_PIECES; ++i){ pth->count[m.piece() + i] -= 1; }
+        }else{
+            pth->count[m.piece()] -= N_PONG_PIECES;
+        }
+    }
+    ExtPieceSet eps;
+    eps.clear();
+    int pieces = 0;
+    for(Piece p : allPieces){
+        for(int i = 0; i < pth->count[p]; ++i){
+            eps += toExtPiece(p);
+            pieces += 1;
+        }
+    }
+    pth->hand.set(eps);
+    for(Meld m : melds){
+        if(m.chow()){
+            pth->hand.addOpenedSeq(m);
+        }else{
+            pth->hand.addOpenedGroup(m);
+        }
+    }
+    pth->opened = melds.size();
+    pth->checkAcceptable = (pieces % 3) == 1;
+
+    StepsOracle oracle;
+    for(Piece p = static_cast<Piece>(0); p <= PIECE_MAX; ++p){ oracle.count[p] = 0; }
+    for(Piece p : allPieces){ oracle.count[p] = pth->count[p]; }
+    oracle.opened = pth->opened;
+    for(int special = 0; special < 2; ++special){
+        pth->answerSteps[special] = oracle.steps(special, &pth->answerAcceptable[special]);
+    }
+}
+
+/**************************照合と速度計測**************************/
+
+double timerOverhead = 0;
+
+template<class callback_t>
+int testImplementation(const char *name, bool special,
+                       const std::vector<TestHand> *const samples, const callback_t& calc){
+    // 全カテゴリの手牌で照合し、カテゴリごとに1回あたりの時間の分布を出す
+    // 返り値は食い違った手牌の数
+    int mismatches = 0;
+    cerr << name << endl;
+    for(int c = 0; c < N_CATEGORIES; ++c){
+        std::vector<double> ns;
+        ns.reserve(samples[c].size());
+        for(const TestHand& th : samples[c]){
+            PieceExistance acceptable;
+            auto start = std::chrono::steady_clock::now();
+            const int steps = calc(th.hand, &acceptable);
+            auto end = std::chrono::steady_clock::now();
+            ns.push_back(max(0.0, std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count() - timerOverhead));
+            const bool stepsOk = steps == th.answerSteps[special];
+            const bool acceptableOk = !th.checkAcceptable || acceptable == th.answerAcceptable[special];
+            if(!stepsOk || !acceptableOk){
+                if(mismatches < 20){
+                    cerr << "  mismatch in " << categoryName[c] << " : " << th.hand << endl;
+                    cerr << "    steps " << steps << " (answer " << th.answerSteps[special] << ")";
+                    if(th.checkAcceptable){
+                        cerr << " acceptable " << acceptable << " (answer " << th.answerAcceptable[special] << ")";
+                    }
+                    cerr << endl;
+                }
+                mismatches += 1;
+            }
+        }
+        std::sort(ns.begin(), ns.end());
+        const int n = ns.size();
+        cerr << "  " << std::setw(13) << std::left << categoryName[c] << std::right << " : "
+        << std::fixed << std::setprecision(1)
+        << "p50 " << ns[n / 2] << " p90 " << ns[n * 9 / 10]
+        << " p99 " << ns[n * 99 / 100] << " max " << ns[n - 1] << " ns/call" << endl;
+    }
+    cerr << "  " << mismatches << " mismatches" << endl;
+    return mismatches;
+}
+
+int main(int argc, char* argv[]){
+
+    int samplesPerCategory = 20000;
+    bool mizukami = true;
+    for(int c = 1; c < argc; ++c){
+        if(!strcmp(argv[c], "-n")){ // カテゴリごとの手牌数
+            samplesPerCategory = atoi(argv[++c]);
+        }else if(!strcmp(argv[c], "-nm")){ // 水上さんのテーブルを使わない
+            mizukami = false;
+        }
+    }
+
+    // 比較用の水上さんのテーブル
+    // 無ければ新しいテーブル同士の検証だけ行う
+    if(mizukami && (initShantenTable() < 0 || initAcceptableTable() < 0)){
+        cerr << "Mizukami tables are not available. skip comparison with them." << endl;
+        mizukami = false;
+    }
+    waitStepsTables();
+
+    iterateNaivePiece([](Piece p)->void{ allPieces.push_back(p); });
+
+    // 時刻取得の時間
+    {
+        std::vector<double> ns;
+        for(int i = 0; i < 10000; ++i){
+            auto start = std::chrono::steady_clock::now();
+            auto end = std::chrono::steady_clock::now();
+            ns.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        }
+        std::sort(ns.begin(), ns.end());
+        timerOverhead = ns[ns.size() / 2];
+        cerr << "timer overhead " << timerOverhead << " ns (subtracted)" << endl;
+    }
+
+    XorShift64 dice;
+    dice.srand((unsigned int)time(NULL));
+    std::vector<TestHand> samples[N_CATEGORIES];
+    for(int c = 0; c < N_CATEGORIES; ++c){
+        samples[c].resize(samplesPerCategory);
+        for(TestHand& th : samples[c]){
+            dealTestHand(c, &dice, &th);
+        }
+    }
+
+    int mismatches = 0;
+    mismatches += testImplementation("calcNormalMinimumSteps (combination table)", false, samples,
+                                     [](const Hand& hand, PieceExistance *const pac)->int{
+                                         return calcNormalMinimumSteps(hand, pac);
+                                     });
+    mismatches += testImplementation("calcNormalMinimumStepsLoop", false, samples,
+                                     [](const Hand& hand, PieceExistance *const pac)->int{
+                                         return calcNormalMinimumStepsLoop(hand, pac);
+                                     });
+    mismatches += testImplementation("calcMinimumSteps (with special forms)", true, samples,
+                                     [](const Hand& hand, PieceExistance *const pac)->int{
+                                         return calcMinimumSteps(hand, pac);
+                                     });
+    if(mizukami){
+        mismatches += testImplementation("calcAcceptableBits", false, samples,
+                                         [](const Hand& hand, PieceExistance *const pac)->int{
+                                             return calcAcceptableBits(hand.piece, hand.openedMelds(), pac);
+                                         });
+    }
+
+    if(mismatches > 0){
+        cerr << "failed to calculate minimum steps." << endl;
+        return -1;
+    }
+    return 0;
+}
@@ -4,6 +4,8 @@
  */
 
 // 水上さん作のシャンテン数、受け入れ数計算用テーブルを自分が使いやすいように変形して保存
+// -g : 水上さんのテーブルを使わずに計算して保存
+// -b : 変換済みのテキストテーブルをバイナリにして保存
 
 #include "../mahjong.hpp"
 
@@ -31,9 +33,9 @@ uint64_t reverseAcceptableBits(uint64_t v){
     return a;
 }
 
-void calcValue(int r, int cnt, int mizu3b, int mizu5x, int my5x, int myHash){
+void calcValue(int r, int cnt, int mizu5x, int my5x, int myHash){
     if(r == (int)N_RANKS){
-        myMinimumStepsInfoTable[my5x] = shantenTable[mizu3b];
+        myMinimumStepsInfoTable[my5x] = shantenTable[mizu5x];
         //myAcceptableInfoTable[my5x * 2 + 0] = acceptableTable0[mizu5x];
         //myAcceptableInfoTable[my5x * 2 + 1] = acceptableTable1[mizu5x];
         myAcceptableInfoTable[my5x * 2 + 0] = reverseAcceptableBits(acceptableTable0[mizu5x]);
@@ -54,7 +56,6 @@ void calcValue(int r, int cnt, int mizu3b, int mizu5x, int my5x, int myHash){
         if(1 || r != RANK_RED){
             for(int i = 0; i <= N_ONE_PIECE; ++i){
                 calcValue(r + 1, cnt + i,
-                          mizu3b | (i << (3 * (N_RANKS - 1 - r))),
                           mizu5x + i * ipow5Table[N_RANKS - 1 - r],
                           my5x   + i * ipow5Table[r],
                           myHash + i * hash[r]);
@@ -62,7 +63,6 @@ void calcValue(int r, int cnt, int mizu3b, int mizu5x, int my5x, int myHash){
         }else{
             for(int i = 0; i <= N_ONE_PIECE - 1; ++i){
                 calcValue(r + 1, cnt + i,
-                          mizu3b | (i << (3 * (N_RANKS - 1 - r))),
                           mizu5x + i * ipow5Table[N_RANKS - 1 - r],
                           my5x   + i * ipow5Table[r],
                           myHash + i * hash[r]);
@@ -70,7 +70,6 @@ void calcValue(int r, int cnt, int mizu3b, int mizu5x, int my5x, int myHash){
             // 赤
             for(int i = 0; i <= 1; ++i){
                 calcValue(r + 1, cnt + i,
-                          mizu3b | (i << (3 * (N_RANKS - 1 - r))),
                           mizu5x + i * ipow5Table[N_RANKS - 1 - r],
                           my5x   + i * ipow5Table[r],
                           myHash + i * hash[r]);
@@ -88,7 +87,7 @@ void countPatterns(){
         hash[i] = mt();
     }
     
-    calcValue(0, 0, 0, 0, 0, 0);
+    calcValue(0, 0, 0, 0, 0);
     
     for(int i = 0; i < u.size(); ++i){
         cerr << i << " " << u[i] << endl;
@@ -99,6 +98,28 @@ void countPatterns(){
 
 int main(int argc, char *argv[]){
     
+    waitStepsTables();
+    
+    for(int c = 1; c < argc; ++c){
+        if(!strcmp(argv[c], "-b")){
+            // テキストテーブルをバイナリに変換するのみ
+            if(loadStepsTextTables() < 0){
+                return -1;
+            }
+            return saveStepsTableFile(STEPS_TABLE_FILE_PATH);
+        }else if(!strcmp(argv[c], "-g")){
+            // 水上さんのテーブルを使わずに計算してバイナリに保存
+            if(generateStepsTables() < 0){
+                return -1;
+            }
+            return saveStepsTableFile(STEPS_TABLE_FILE_PATH);
+        }
+    }
+    
+    if(initShantenTable() < 0 || initAcceptableTable() < 0){
+        return -1;
+    }
+    
     memset(myMinimumStepsInfoTable, 0, sizeof(myMinimumStepsInfoTable));
     memset(myAcceptableInfoTable, 0, sizeof(myAcceptableInfoTable));
     
@@ -106,17 +127,6 @@ int main(int argc, char *argv[]){
     
     countPatterns();
     
-    const char *opath0 = "./data/minimumStepsInfoTable.bin";
-    const char *opath1 = "./data/acceptableInfoTable.bin";
-    
-    /*FILE *pf;
-    pf = fopen(opath0, "wb");
-    fwrite(myMinimumStepsInfoTable, sizeof(myMinimumStepsInfoTable), 1, pf);
-    fclose(pf);
-    pf = fopen(opath1, "wb");
-    fwrite(myAcceptableInfoTable, sizeof(myAcceptableInfoTable), 1, pf);
-    fclose(pf);*/
-    
     std::string op0 = "./data/minimumStepsInfoTable.dat";
     std::string op1 = "./data/acceptableInfoTable.dat";
     
@@ -135,5 +145,11 @@ int main(int argc, char *argv[]){
         ofs1 << myAcceptableInfoTable[i];
     }
     
+    // 起動時に mmap するバイナリ(レコード形式)
+    if(packStepsTables(myMinimumStepsInfoTable, myAcceptableInfoTable) < 0
+       || saveStepsTableFile(STEPS_TABLE_FILE_PATH) < 0){
+        return -1;
+    }
+    
     return 0;
 }